@@ -28,6 +28,7 @@ void process_admin_command ()
       case 'q':  // dump ready queue and list of processes completed IO
         dump_ready_queue ();
         dump_endWait_list ();
+        dump_pending_queue ();
         break;
       case 'r':   // dump the list of available PCBs
         dump_registers (); break;
@@ -37,6 +38,10 @@ void process_admin_command ()
         dump_PCB_memory (); break;
       case 'f':   // dump memory frames and free frame list
         dump_memoryframe_info (); break;
+      case 'l':   // dump the TLB and its hit/miss counters
+        dump_tlb (); break;
+      case 'v':   // dump memory statistics and replacement policy state
+        dump_memory_stats (); break;
       case 'n':   // dump the content of the entire memory
         dump_memory (); break;
       case 'e':   // dump events in clock.c
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "agescan.h"
+
+//======================================================================
+// Benchmark for the age vector kernels (agescan.c)
+// usage: agebench [#frames] [#rounds]
+// reports the time of one age shift and one min-age search, scaled to
+// one million frames, for each kernel the cpu supports
+//======================================================================
+
+double now_usec ()
+{ struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec*1000000.0 + ts.tv_nsec/1000.0);
+}
+
+// ages as the aging policy produces them: a power of 2 <= 0x80
+// with a single zero age, so the min search has to go far
+void fill_ages (ageType *age, int n)
+{ int i;
+
+  srand (1);
+  for (i=0; i<n; i++) age[i] = 0x80 >> (rand() % 8);
+  age[n - n/3] = 0;
+}
+
+void main (int argc, char *argv[])
+{ int n = 1000000, rounds = 200;
+  int k, r, index;
+  double start, shiftTime, minTime, scale;
+  ageType *age;
+
+  if (argc > 1) n = atoi (argv[1]);
+  if (argc > 2) rounds = atoi (argv[2]);
+  age = (ageType *) malloc (n*sizeof(ageType));
+  scale = 1000000.0 / n / rounds;
+
+  printf ("Age scan benchmark: %d frames, %d rounds\n", n, rounds);
+  for (k=0; k<numAgeKernels; k++)
+  { if (! ageKernels[k].supported ())
+    { printf ("%-8s not supported by this cpu\n", ageKernels[k].name);
+      continue;
+    }
+    fill_ages (age, n);
+    start = now_usec ();
+    for (r=0; r<rounds; r++) ageKernels[k].shift (age, n);
+    shiftTime = (now_usec () - start) * scale;
+      // shift time does not depend on the values, no need to refill
+
+    fill_ages (age, n);
+    index = 0;
+    start = now_usec ();
+    for (r=0; r<rounds; r++) index += ageKernels[k].min_index (age, n);
+    minTime = (now_usec () - start) * scale;
+
+    printf ("%-8s shift: %8.1f us, min search: %8.1f us per million frames"
+            " (min at %d)\n", ageKernels[k].name, shiftTime, minTime,
+            index/rounds);
+  }
+}
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include "agescan.h"
+
+//======================================================================
+// Age vector kernels for the periodic age scan and the min-age search.
+// Each kernel has a scalar version and, on x86, SSE4.1 and AVX2 versions.
+// initialize_age_kernel picks the widest one the cpu supports at run time,
+// the simd functions are compiled with the target attribute, so the
+// makefile does not need any -m flag.
+//======================================================================
+
+AgeKernel *ageKernel;
+
+
+//==========================================
+// scalar versions, always supported
+//==========================================
+
+int scalar_supported () { return (1); }
+
+void scalar_shift (ageType *age, int n)
+{ int i;
+
+  for (i=0; i<n; i++) age[i] = age[i] >> 1;
+}
+
+int scalar_min_index (ageType *age, int n)
+{ int i, index = -1;
+
+  for (i=0; i<n; i++) if (index < 0 || age[i] < age[index]) index = i;
+  return (index);
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+//==========================================
+// SSE4.1 versions, 4 ages at a time
+// the tail that does not fill a vector is done by the scalar code
+//==========================================
+
+int sse_supported () { return (__builtin_cpu_supports ("sse4.1")); }
+
+__attribute__((target("sse4.1")))
+void sse_shift (ageType *age, int n)
+{ int i;
+
+  for (i=0; i+4<=n; i+=4)
+  { __m128i v = _mm_loadu_si128 ((__m128i *) &age[i]);
+    _mm_storeu_si128 ((__m128i *) &age[i], _mm_srli_epi32 (v, 1));
+  }
+  scalar_shift (&age[i], n-i);
+}
+
+__attribute__((target("sse4.1")))
+int sse_min_index (ageType *age, int n)
+{ int i, mask;
+  ageType low, lanes[4];
+  __m128i vmin, key;
+
+  if (n < 4) return (scalar_min_index (age, n));
+  vmin = _mm_loadu_si128 ((__m128i *) &age[0]);
+  for (i=4; i+4<=n; i+=4)
+    vmin = _mm_min_epu32 (vmin, _mm_loadu_si128 ((__m128i *) &age[i]));
+  _mm_storeu_si128 ((__m128i *) lanes, vmin);
+  low = lanes[0];
+  for (i=1; i<4; i++) if (lanes[i] < low) low = lanes[i];
+  for (i=(n/4)*4; i<n; i++) if (age[i] < low) low = age[i];
+
+  // second pass, the first index with the lowest age
+  key = _mm_set1_epi32 (low);
+  for (i=0; i+4<=n; i+=4)
+  { __m128i v = _mm_loadu_si128 ((__m128i *) &age[i]);
+    mask = _mm_movemask_ps (_mm_castsi128_ps (_mm_cmpeq_epi32 (v, key)));
+    if (mask != 0) return (i + __builtin_ctz (mask));
+  }
+  for (; i<n; i++) if (age[i] == low) return (i);
+  return (-1);
+}
+
+
+//==========================================
+// AVX2 versions, 8 ages at a time
+//==========================================
+
+int avx2_supported () { return (__builtin_cpu_supports ("avx2")); }
+
+__attribute__((target("avx2")))
+void avx2_shift (ageType *age, int n)
+{ int i;
+
+  for (i=0; i+8<=n; i+=8)
+  { __m256i v = _mm256_loadu_si256 ((__m256i *) &age[i]);
+    _mm256_storeu_si256 ((__m256i *) &age[i], _mm256_srli_epi32 (v, 1));
+  }
+  scalar_shift (&age[i], n-i);
+}
+
+__attribute__((target("avx2")))
+int avx2_min_index (ageType *age, int n)
+{ int i, mask;
+  ageType low, lanes[8];
+  __m256i vmin, key;
+
+  if (n < 8) return (scalar_min_index (age, n));
+  vmin = _mm256_loadu_si256 ((__m256i *) &age[0]);
+  for (i=8; i+8<=n; i+=8)
+    vmin = _mm256_min_epu32 (vmin, _mm256_loadu_si256 ((__m256i *) &age[i]));
+  _mm256_storeu_si256 ((__m256i *) lanes, vmin);
+  low = lanes[0];
+  for (i=1; i<8; i++) if (lanes[i] < low) low = lanes[i];
+  for (i=(n/8)*8; i<n; i++) if (age[i] < low) low = age[i];
+
+  key = _mm256_set1_epi32 (low);
+  for (i=0; i+8<=n; i+=8)
+  { __m256i v = _mm256_loadu_si256 ((__m256i *) &age[i]);
+    mask = _mm256_movemask_ps (_mm256_castsi256_ps (
+                               _mm256_cmpeq_epi32 (v, key)));
+    if (mask != 0) return (i + __builtin_ctz (mask));
+  }
+  for (; i<n; i++) if (age[i] == low) return (i);
+  return (-1);
+}
+
+#endif
+
+
+AgeKernel ageKernels[] =
+{ { "scalar", scalar_supported, scalar_shift, scalar_min_index },
+#if defined(__x86_64__) || defined(__i386__)
+  { "sse4.1", sse_supported, sse_shift, sse_min_index },
+  { "avx2", avx2_supported, avx2_shift, avx2_min_index },
+#endif
+};
+
+int numAgeKernels = sizeof(ageKernels)/sizeof(AgeKernel);
+
+void initialize_age_kernel ()
+{ int i;
+
+  ageKernel = &ageKernels[0];
+  for (i=1; i<numAgeKernels; i++)
+    if (ageKernels[i].supported ()) ageKernel = &ageKernels[i];
+}
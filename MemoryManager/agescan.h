@@ -0,0 +1,19 @@
+//=============== agescan.c related definitions ====================
+// age vector kernels, used by the age scan in replace.c and by agebench.c
+// the kernels work on a contiguous array of n ages
+
+typedef unsigned ageType;
+
+typedef struct
+{ char *name;
+  int (*supported) ();   // whether the cpu can run the kernel
+  void (*shift) (ageType *age, int n);   // age[i] = age[i] >> 1
+  int (*min_index) (ageType *age, int n);
+       // returns the first i with the lowest age[i], or -1 if n = 0
+} AgeKernel;
+
+extern AgeKernel ageKernels[];   // scalar first, then the simd versions
+extern int numAgeKernels;
+extern AgeKernel *ageKernel;   // the best supported kernel
+
+void initialize_age_kernel ();
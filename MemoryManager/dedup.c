@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include "simos.h"
+
+
+//======================================================================
+// Content addressed swap store (swapDedup = 1), used by swap.c
+// The swap file is a pool of page slots instead of a fixed area of
+// maxPpages pages per process.  A written page is hashed, a page with the
+// same content as a slot in use only takes a reference to that slot, only
+// new content is written to a slot.  An all zero page is never written,
+// it is read as zeros without any disk IO.  A page never written (or
+// dropped at process end) is a zero page, like the zeroed swap space.
+// The slots come from the swap slot allocator of swap.c, so the file only
+// grows to the #slots with distinct content in use at once.
+// Pages are looked up by their 64 bit hash, a slot with the same hash is
+// read back and compared, so a hash collision is stored as new content.
+//======================================================================
+
+#define zeroSlot -1   // pageSlot of a page that is all zeros
+
+typedef struct
+{ unsigned long long hash;
+  int refs;   // #pages using the slot, 0 if the slot is free
+  int next;   // hash chain
+} DedupSlot;
+
+DedupSlot *slots;
+int *pageSlot;   // [pid*maxPpages + page], slot of the page or zeroSlot
+int *slotBucket;   // heads of the hash chains
+int numBuckets;   // power of 2
+int dedupWrites = 0, dedupShared = 0, dedupZeroWrites = 0;   // statistics
+int dedupReads = 0, dedupZeroReads = 0, dedupCollisions = 0;
+
+sem_t dedup_mutex;
+
+unsigned long long dedup_hash (unsigned *buf)
+{ unsigned long long h = 14695981039346656037ull;
+  int i;
+
+  for (i=0; i<pageSize; i++) h = (h ^ buf[i]) * 1099511628211ull;
+  return (h);
+}
+
+int zero_page (unsigned *buf)
+{ int i;
+
+  for (i=0; i<pageSize; i++) if (buf[i] != 0) return (0);
+  return (1);
+}
+
+// the page no longer uses its slot, the slot is freed with its last page
+void release_slot (int index)
+{ int slot = pageSlot[index];
+  int *p;
+
+  pageSlot[index] = zeroSlot;
+  if (slot == zeroSlot || --slots[slot].refs > 0) return;
+  p = &slotBucket[slots[slot].hash & (numBuckets-1)];
+  while (*p != slot) p = &slots[*p].next;
+  *p = slots[slot].next;
+  free_swap_slot (slot);
+}
+
+void dedup_write (int pid, int page, unsigned *buf)
+{ int index = pid*maxPpages + page;
+  unsigned content[pageSize];   // a slot read back to compare
+  unsigned long long h;
+  int slot;
+
+  sem_wait (&dedup_mutex);
+  if (zero_page (buf))
+  { release_slot (index);
+    dedupZeroWrites++;
+    sem_post (&dedup_mutex);
+    return;
+  }
+  h = dedup_hash (buf);
+  for (slot=slotBucket[h & (numBuckets-1)]; slot!=nullIndex;
+       slot=slots[slot].next)
+    if (slots[slot].hash == h)
+    { read_swap_slot (slot, content);
+      if (memcmp (content, buf, pageSize*dataSize) == 0) break;
+      dedupCollisions++;
+    }
+  if (slot != nullIndex)
+  { if (pageSlot[index] != slot)
+    { slots[slot].refs++;   // before the release, it may be the same slot
+      release_slot (index);
+      pageSlot[index] = slot;
+    }
+    dedupShared++;
+    sem_post (&dedup_mutex);
+    return;
+  }
+  release_slot (index);
+  slot = alloc_swap_slot (nullIndex);
+  slots[slot].hash = h;
+  slots[slot].refs = 1;
+  slots[slot].next = slotBucket[h & (numBuckets-1)];
+  slotBucket[h & (numBuckets-1)] = slot;
+  pageSlot[index] = slot;
+  dedupWrites++;
+  write_swap_slot (slot, buf);
+  sem_post (&dedup_mutex);
+}
+
+// count: 0 for the dumps, which are not in the statistics
+void dedup_read (int pid, int page, unsigned *buf, int count)
+{ int slot;
+
+  sem_wait (&dedup_mutex);
+  slot = pageSlot[pid*maxPpages + page];
+  if (slot == zeroSlot)
+  { memset (buf, 0, pageSize*dataSize);
+    if (count) dedupZeroReads++;
+  }
+  else
+  { read_swap_slot (slot, buf);
+    if (count) dedupReads++;
+  }
+  sem_post (&dedup_mutex);
+}
+
+void dedup_drop (int pid)
+{ int page;
+
+  sem_wait (&dedup_mutex);
+  for (page=0; page<maxPpages; page++) release_slot (pid*maxPpages + page);
+  sem_post (&dedup_mutex);
+}
+
+void dump_dedup_stats ()
+{
+  sem_wait (&dedup_mutex);
+  printf ("Dedup swap store: writes = %d, shared = %d, zero = %d\n",
+          dedupWrites, dedupShared, dedupZeroWrites);
+  printf ("  reads = %d, zero reads = %d, hash collisions = %d\n",
+          dedupReads, dedupZeroReads, dedupCollisions);
+  sem_post (&dedup_mutex);
+}
+
+void initialize_dedup ()
+{ int i, n = maxProcess*maxPpages;
+
+  // a slot in use is used by a page, the allocator has a slot per page
+  slots = (DedupSlot *) malloc (n*sizeof(DedupSlot));
+  pageSlot = (int *) malloc (n*sizeof(int));
+  for (i=0; i<n; i++) pageSlot[i] = zeroSlot;
+  for (numBuckets=2; numBuckets < n; numBuckets = numBuckets << 1);
+  slotBucket = (int *) malloc (numBuckets*sizeof(int));
+  for (i=0; i<numBuckets; i++) slotBucket[i] = nullIndex;
+  sem_init (&dedup_mutex, 0, 1);
+}
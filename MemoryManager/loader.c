@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "simos.h"
 
 
@@ -35,12 +36,90 @@ int load_data (mType *buf, int page, int offset)
 }
 
 
+//==========================================
+// program images (shareText = 1): a program file is parsed only once, its
+// pages are kept in the image and copied to the swap space of each process
+// loaded from it, the pages with instructions (text pages) are shared by
+// these processes (see paging.c).  Program files should not change while
+// the system runs.  At most maxProcess images, later programs get none.
+//==========================================
+
+typedef struct
+{ char *fname;
+  int numPages, textPages;
+  mType **pages;
+} ProgImage;
+
+ProgImage *images = NULL;
+int numImages = 0;
+int *imageOf = NULL;   // indexed by pid, nullIndex if pid has no image
+
+int find_program_image (char *fname)
+{ int i;
+
+  if (imageOf == NULL)
+  { images = (ProgImage *) malloc (maxProcess*sizeof(ProgImage));
+    imageOf = (int *) malloc (maxProcess*sizeof(int));
+    for (i=0; i<maxProcess; i++) imageOf[i] = nullIndex;
+  }
+  for (i=0; i<numImages; i++)
+    if (strcmp (images[i].fname, fname) == 0) return (i);
+  return (nullIndex);
+}
+
+int new_program_image (char *fname, int numpages, int textpages)
+{ ProgImage *img;
+
+  if (numImages == maxProcess) return (nullIndex);
+  img = &images[numImages];
+  img->fname = (char *) malloc (strlen (fname) + 1);
+  strcpy (img->fname, fname);
+  img->numPages = numpages;
+  img->textPages = textpages;
+  img->pages = (mType **) malloc (numpages*sizeof(mType *));
+  return (numImages++);
+}
+
+// load a process from the image of its program, the file is not read
+int load_image_to_swap (int pid, int image)
+{ ProgImage *img = &images[image];
+  mType *buf;
+  int i;
+
+  printf("Program image %s: %d pages, %d text pages\n",
+         img->fname, img->numPages, img->textPages);
+  buf = (mType *) malloc (img->numPages*pageSize*sizeof(mType));
+  for (i = 0; i < img->numPages; i++) {
+	  memcpy (buf + i*pageSize, img->pages[i], pageSize*sizeof(mType));
+	  update_process_pagetable (pid, i, diskPage);
+  }
+  if (img->numPages > 0)
+    insert_swapQ_pages (pid, 0, img->numPages, (unsigned *) buf,
+                        actWrite, freeBuf);
+  else free (buf);
+  imageOf[pid] = image;
+  return (img->numPages);
+}
+
+int process_image (int pid)
+{
+  if (imageOf == NULL) return (nullIndex);
+  return (imageOf[pid]);
+}
+
+int image_text_pages (int image)
+{ return (images[image].textPages); }
+
+
 // load program to swap space, returns the #pages loaded
 int load_process_to_swap (int pid, char *fname)
 { 
   // read from program file "fname" and call load_instruction & load_data
   // to load the program into the buffer, write the program into
   // swap space by inserting it to swapQ
+  // the pages are loaded into one buffer and written with one request, the
+  // swap space keeps the pages of a process in consecutive slots, so the
+  // whole program goes to the disk in one IO
   // update the process page table to indicate that the page is not empty
   // and it is on disk (= diskPage)
 
@@ -49,8 +128,12 @@ int load_process_to_swap (int pid, char *fname)
 	  int ret, i, j, opcode, operand;
 	  int count = 0;
 	  float data;
+	  int image = nullIndex;
+	  mType *pages;
 
 	init_process_pagetable (pid);
+	if (shareText && (image = find_program_image (fname)) != nullIndex)
+		return (load_image_to_swap (pid, image));
 	fprog = fopen (fname, "r");
 	  if (fprog == NULL)
 	  { printf ("Submission Error: Incorrect program name: %s!\n", fname);
@@ -69,9 +152,12 @@ int load_process_to_swap (int pid, char *fname)
 	  if(requiredPages > maxPpages){
 		  return progError;
 	  }else{
+		  if (shareText)
+			  image = new_program_image (fname, requiredPages,
+			                             (numinstr+pageSize-1)/pageSize);
+		  pages = (mType *) calloc (requiredPages*pageSize, sizeof(mType));
 		  for (i = 0; i < requiredPages; i++) {
-			  mType *buf = (mType *) malloc (pageSize*sizeof(mType));
-				memset(buf, 0, sizeof(buf)*sizeof(int));
+			  mType *buf = pages + i*pageSize;
 			  int offset = 0;
 			  for (j = 0; j < pageSize; ++j) {
 				  if(count == msize){
@@ -96,8 +182,16 @@ int load_process_to_swap (int pid, char *fname)
 
 		  }
 			  update_process_pagetable (pid, i, diskPage);
-			  insert_swapQ (pid, i, buf, actWrite, freeBuf);
+			  if (image != nullIndex) {
+				  images[image].pages[i] = (mType *) malloc (pageSize*sizeof(mType));
+				  memcpy (images[image].pages[i], buf, pageSize*sizeof(mType));
+			  }
 		}
+		 if (requiredPages > 0)
+		   insert_swapQ_pages (pid, 0, requiredPages, (unsigned *) pages,
+		                       actWrite, freeBuf);
+		 else free (pages);
+		 if (shareText) imageOf[pid] = image;
 		 return requiredPages;
 	  }
 }
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "simos.h"
 
 
@@ -14,35 +15,19 @@
 
 mType *Memory;   // The physical memory, size = pageSize*numFrames
 
-typedef unsigned ageType;
-typedef struct
-{ int pid, page;   // the frame is allocated to process pid for page page
-  ageType age;
-  char free, dirty, pinned;   // in real systems, these are bits
-  int next, prev;
-} FrameStruct;
-
-FrameStruct *memFrame;   // memFrame[numFrames]
 int freeFhead, freeFtail;   // the head and tail of free frame list
-
-// define special values for page/frame number
-#define nullIndex -1   // free frame list null pointer
-#define nullPage -1   // page does not exist yet
-#define diskPage -2   // page is on disk swap space
-#define pendingPage -3  // page is pending till it is actually swapped
-   // have to ensure: #memory-frames < address-space/2, (pageSize >= 2)
-   //    becuase we use negative values with the frame number
-   // nullPage & diskPage are used in process page table 
-
-// define values for fields in FrameStruct
-#define zeroAge 0x00000000
-#define highestAge 0x80
-#define dirtyFrame 1
-#define cleanFrame 0
-#define freeFrame 1
-#define usedFrame 0
-#define pinnedFrame 1
-#define nopinFrame 0
+int freeFcount;   // #frames on the free list (page-out daemon)
+
+// reference and dirty bitmaps, one bit per frame, set by the memory access
+// like hardware R/M bits, instead of writing the frame metadata each time
+// the bits are folded into the frame metadata and the replacement policy
+// (on_access) by the age scan and before frames are selected or reused
+// a frame with its dirty bit set always has its reference bit set
+unsigned *refBits, *dirtyBits;
+int bitWords;   // #words of each bitmap
+#define bitWord(findex) ((findex) >> 5)
+#define bitMask(findex) (1u << ((findex) & 31))
+   // memFrame and the frame field definitions are in simos.h
 
 // define shifts and masks for instruction and memory address 
 #define opcodeShift 24
@@ -52,6 +37,16 @@ int freeFhead, freeFtail;   // the head and tail of free frame list
 unsigned pageoffsetMask;
 int pagenumShift; // 2^pagenumShift = pageSize
 
+// software TLB, direct mapped, tagged with pid, caches page->frame mappings
+// config.sys input: tlbSize (0 disables the TLB)
+// an entry is invalid when its pid is nullPid
+typedef struct
+{ int pid, page, frame;
+} TLBentry;
+
+TLBentry *TLB;   // TLB[tlbSize]
+int tlbHits, tlbMisses;
+
 //============================
 // Our memory implementation is a mix of memory manager and physical memory.
 // get_instr, put_instr, get_data, put_data are the physical memory operations
@@ -65,14 +60,93 @@ int pagenumShift; // 2^pagenumShift = pageSize
 // run time memory access operations, called by cpu.c
 //==========================================
 
-// define rwflag to indicate whehter the addr computation is for read or write
-#define flagRead 1
-#define flagWrite 2
-
 #define gdata 1
 #define ginstr 2
 
 int pfpage;
+int accessFrame;   // frame of the last successful address calculation
+                   // get/put functions use it to update the frame metadata
+int numAccesses, numFaults;   // for the hit ratio of the replacement policy
+
+int get_pte (int pid, int page);   // page table access, see below
+int pte_frame (int pid, int page, int pte);
+void readahead_waste (int findex);
+int local_select_victim (int pid);
+void unshare_text_frame (int findex);
+int drop_shared_frame (int pid, int page, int frame);
+void ksm_unshare (int findex);
+int ksm_drop (int pid, int page, int frame);
+
+int *textImage;   // indexed by pid, program image of pid, nullIndex if none
+int *textFrame;   // [image*maxPpages + page], shared frame or nullIndex
+char *textDiverged;   // [pid*maxPpages + page], 1 once pid wrote the page
+                  // shared program text, see below
+
+//==========================================
+// TLB operations, the TLB is consulted before the process page table
+// entries must be invalidated whenever the page table entry changes
+//==========================================
+
+#define tlb_index(pid,page) (((unsigned)(page) + (pid) * 7) % tlbSize)
+
+int tlb_lookup (int pid, int page)
+{ TLBentry *entry;
+
+  if (tlbSize <= 0) return (nullIndex);
+  entry = &TLB[tlb_index(pid,page)];
+  if (entry->pid == pid && entry->page == page)
+  { tlbHits++; return (entry->frame); }
+  tlbMisses++;
+  return (nullIndex);
+}
+
+void tlb_insert (int pid, int page, int frame)
+{ TLBentry *entry;
+
+  if (tlbSize <= 0) return;
+  entry = &TLB[tlb_index(pid,page)];
+  entry->pid = pid;
+  entry->page = page;
+  entry->frame = frame;
+}
+
+void tlb_invalidate (int pid, int page)
+{ TLBentry *entry;
+
+  if (tlbSize <= 0) return;
+  entry = &TLB[tlb_index(pid,page)];
+  if (entry->pid == pid && entry->page == page) entry->pid = nullPid;
+}
+
+void tlb_flush_process (int pid)
+{ int i;
+
+  for (i=0; i<tlbSize; i++)
+    if (TLB[i].pid == pid) TLB[i].pid = nullPid;
+}
+
+void initialize_tlb ()
+{ int i;
+
+  tlbHits = 0; tlbMisses = 0;
+  if (tlbSize <= 0) return;
+  TLB = (TLBentry *) malloc (tlbSize*sizeof(TLBentry));
+  for (i=0; i<tlbSize; i++) TLB[i].pid = nullPid;
+}
+
+void dump_tlb ()
+{ int i, total;
+
+  printf ("******************** TLB Dump\n");
+  total = tlbHits + tlbMisses;
+  printf ("TLB size = %d, hits/misses = %d/%d", tlbSize, tlbHits, tlbMisses);
+  if (total > 0) printf (", hit ratio = %.2f%%", 100.0*tlbHits/total);
+  printf ("\n");
+  for (i=0; i<tlbSize; i++)
+    if (TLB[i].pid != nullPid)
+      printf ("Entry %d: pid/page/frame=%d,%d,%d\n",
+              i, TLB[i].pid, TLB[i].page, TLB[i].frame);
+}
 
 // address calcuation are performed for the program in execution
 // so, we can get address related infor from CPU registers
@@ -87,24 +161,37 @@ int calculate_memory_address (unsigned offset, int rwflag)
 
 	int pageNumber = offset/pageSize;
 	int frameOffset = offset%pageSize;
+	int frame;
 
-	if(pageNumber > maxPpages){
+	if(pageNumber >= maxPpages){
 		return mError;
 	}
 
-	if(PCB[CPU.Pid]->PTptr[pageNumber] == diskPage){
-		set_interrupt (pFaultException);
-		return mPFault;
-	}
+	frame = tlb_lookup(CPU.Pid, pageNumber);
+	if(frame == nullIndex){
+		frame = pte_frame(CPU.Pid, pageNumber, get_pte(CPU.Pid, pageNumber));
 
-	if(PCB[CPU.Pid]->PTptr[pageNumber] == nullPage && rwflag == flagRead){
-		return mError;
-	}else if(PCB[CPU.Pid]->PTptr[pageNumber] == nullPage && rwflag == flagWrite){
+		if(frame == diskPage){
+			set_interrupt (pFaultException);
+			return mPFault;
+		}
+
+		if(frame == nullPage && rwflag == flagRead){
+			return mError;
+		}else if(frame == nullPage && rwflag == flagWrite){
+			set_interrupt (pFaultException);
+			return mPFault;
+		}
+		tlb_insert(CPU.Pid, pageNumber, frame);
+	}
+	// shared text frames are read only, a write to them is copy on write
+	if(rwflag == flagWrite && memFrame.refCount[frame] > 0){
 		set_interrupt (pFaultException);
 		return mPFault;
 	}
 
-	int addr = (frameOffset & pageoffsetMask) | (PCB[CPU.Pid]->PTptr[pageNumber] << pagenumShift);
+	accessFrame = frame;
+	int addr = (frameOffset & pageoffsetMask) | (frame << pagenumShift);
 	return addr;
 }
 
@@ -123,7 +210,8 @@ int get_data (int offset)
 	  }
 	  else
 	  {
-		memFrame[PCB[CPU.Pid]->PTptr[offset/pageSize]].age = highestAge;
+		numAccesses++;
+		refBits[bitWord(accessFrame)] |= bitMask(accessFrame);
 		CPU.MBR = Memory[maddr].mData;
 		return (mNormal);
 	  }
@@ -144,8 +232,9 @@ int put_data (int offset)
 		  return (mPFault);
 	  }
 	  else
-	  { memFrame[PCB[CPU.Pid]->PTptr[offset/pageSize]].dirty = dirtyFrame;
-		memFrame[PCB[CPU.Pid]->PTptr[offset/pageSize]].age = highestAge;
+	  { numAccesses++;
+		refBits[bitWord(accessFrame)] |= bitMask(accessFrame);
+		dirtyBits[bitWord(accessFrame)] |= bitMask(accessFrame);
 		Memory[maddr].mData = CPU.AC;
 		return (mNormal);
 	  }
@@ -168,7 +257,8 @@ int get_instruction (int offset)
 	}
     else
     {
-      memFrame[PCB[CPU.Pid]->PTptr[offset/pageSize]].age = highestAge;
+      numAccesses++;
+      refBits[bitWord(accessFrame)] |= bitMask(accessFrame);
       instr = Memory[maddr].mInstr;
 	  CPU.IRopcode = instr >> opcodeShift;
 	  CPU.IRoperand = instr & operandMask;
@@ -192,6 +282,50 @@ void direct_put_data (int findex, int offset, mdType data)
 // Memory and memory frame management
 //==========================================
 
+// fold the reference/dirty bits of one frame into its metadata
+void fold_frame (int findex, unsigned dirtybit)
+{
+  if (dirtybit) memFrame.dirty[findex] = dirtyFrame;
+  memFrame.lastUse[findex] = CPU.numCycles;
+  replacePolicy->on_access(findex, dirtybit ? flagWrite : flagRead);
+}
+
+void fold_frame_bits (int findex)
+{ int w = bitWord(findex);
+  unsigned mask = bitMask(findex);
+
+  if ((refBits[w] & mask) == 0) return;
+  fold_frame(findex, dirtyBits[w] & mask);
+  refBits[w] &= ~mask;
+  dirtyBits[w] &= ~mask;
+}
+
+// clear the bits without folding, the frame gets a new page or is freed
+void clear_frame_bits (int findex)
+{
+  refBits[bitWord(findex)] &= ~bitMask(findex);
+  dirtyBits[bitWord(findex)] &= ~bitMask(findex);
+}
+
+// fold all the set bits, only words with a bit set need any work
+void fold_reference_bits ()
+{ int w, findex;
+  unsigned bits, dbits;
+
+  for (w=0; w<bitWords; w++)
+  { bits = refBits[w];
+    if (bits == 0) continue;
+    dbits = dirtyBits[w];
+    refBits[w] = 0;
+    dirtyBits[w] = 0;
+    while (bits != 0)
+    { findex = w*32 + __builtin_ctz(bits);
+      fold_frame(findex, dbits & bitMask(findex));
+      bits &= bits - 1;
+    }
+  }
+}
+
 void dump_one_frame (int findex)
 { int i;
   // dump the content of one memory frame
@@ -236,18 +370,18 @@ void dump_free_list ()
 		}
 		printf("%d, ",i);
 		count++;
-		i = memFrame[i].next ;
+		i = memFrame.next[i] ;
 	}
 	printf("\n");
 }
 
 void print_one_frameinfo (int indx)
 { printf ("pid/page/age=%d,%d,%x, ",
-          memFrame[indx].pid, memFrame[indx].page, memFrame[indx].age);
+          memFrame.pid[indx], memFrame.page[indx], memFrame.age[indx]);
   printf ("dir/free/pin=%d/%d/%d, ",
-          memFrame[indx].dirty, memFrame[indx].free, memFrame[indx].pinned);
+          memFrame.dirty[indx], memFrame.free[indx], memFrame.pinned[indx]);
   printf ("next/prev=%d,%d\n",
-          memFrame[indx].next, memFrame[indx].prev);
+          memFrame.next[indx], memFrame.prev[indx]);
 }
 
 void dump_memoryframe_info ()
@@ -261,17 +395,33 @@ void dump_memoryframe_info ()
 }
 
 
+// the resident count of a process (PCB) follows the frames it owns
+// (memFrame.pid), local replacement compares it with the frame quota
+void set_frame_owner (int findex, int pid)
+{ int old = memFrame.pid[findex];
+
+  if (old > idlePid && PCB[old] != NULL) PCB[old]->resident--;
+  if (pid > idlePid) PCB[pid]->resident++;
+  memFrame.pid[findex] = pid;
+}
+
 void  update_frame_info (findex, pid, page)
 int findex, pid, page;
 {
   // update the metadata of a frame, need to consider different update scenarios
   // need this function also becuase loader also needs to update memFrame fields
   // while it is better to not to expose memFrame fields externally
-	memFrame[findex].pid = pid;
-	memFrame[findex].age = highestAge;
-	memFrame[findex].page = page;
-	memFrame[findex].dirty = cleanFrame;
-	memFrame[findex].free = usedFrame;
+	replacePolicy->on_free(findex);
+	clear_frame_bits(findex);
+	set_frame_owner(findex, pid);
+	memFrame.age[findex] = highestAge;
+	memFrame.page[findex] = page;
+	memFrame.dirty[findex] = cleanFrame;
+	memFrame.free[findex] = usedFrame;
+	memFrame.lastUse[findex] = CPU.numCycles;
+	memFrame.huge[findex] = 0;
+	memFrame.ahead[findex] = 0;
+	if (memFrame.pinned[findex] == nopinFrame) replacePolicy->on_fault(findex);
 }
 
 // should write dirty frames to disk and remove them from process page table
@@ -281,30 +431,35 @@ int findex, pid, page;
 
 void addto_free_frame (int findex, int status)
 {
+	replacePolicy->on_free(findex);
 	if (status == nullPage) {
-		memFrame[findex].age = zeroAge;
-		memFrame[findex].dirty = cleanFrame;
-		memFrame[findex].free = freeFrame;
-		memFrame[findex].pinned = nopinFrame;
-		memFrame[findex].pid = nullPid;
-		memFrame[findex].page = nullPage;
+		clear_frame_bits(findex);
+		memFrame.age[findex] = zeroAge;
+		memFrame.dirty[findex] = cleanFrame;
+		memFrame.free[findex] = freeFrame;
+		memFrame.pinned[findex] = nopinFrame;
+		set_frame_owner(findex, nullPid);
+		memFrame.page[findex] = nullPage;
+		memFrame.huge[findex] = 0;
+		memFrame.ahead[findex] = 0;
 	} else {
-		memFrame[findex].age = zeroAge;
-		memFrame[findex].free = freeFrame;
-		memFrame[findex].pinned = nopinFrame;
+		memFrame.age[findex] = zeroAge;
+		memFrame.free[findex] = freeFrame;
+		memFrame.pinned[findex] = nopinFrame;
 	}
 
 	if(freeFhead == nullIndex){
 		freeFhead = findex;
-		if (freeFtail == nullIndex) {
-			freeFtail = findex;
-		}
+		freeFtail = findex;
+		memFrame.prev[findex] = nullIndex;
+		memFrame.next[findex] = nullIndex;
 	}else{
-		memFrame[freeFtail].next = findex;
-		memFrame[findex].prev = freeFtail;
-		memFrame[findex].next = nullIndex;
+		memFrame.next[freeFtail] = findex;
+		memFrame.prev[findex] = freeFtail;
+		memFrame.next[findex] = nullIndex;
 		freeFtail = findex;
 	}
+	freeFcount++;
 
 
 
@@ -312,58 +467,139 @@ void addto_free_frame (int findex, int status)
 }
 
 
-int select_agest_frame ()
-{ 
-  // select a frame with the lowest age 
-  // if there are multiple frames with the same lowest age, then choose the one
-  // that is not dirty
-	int i;
-	int cleanCounter = 0;
-	int j;
-	int arbitraryFrame;
-	int lowestAge = memFrame[OSpages].age;
-
-	for (i = OSpages+1; i< numFrames; i++) {
-		if (memFrame[i].age < lowestAge) {
-			lowestAge = memFrame[i].age;
-		}
-	}
+//==========================================
+// batched writeback (writebackBatch > 0): a dirty page to be written is
+// copied to a buffer, so its frame can be reused right away, the buffered
+// pages are written when writebackBatch pages are waiting, every
+// writebackScans age scans, and before one of them is read from swap.
+// A flush sorts the pages by their swap file slot (see swap.c), and writes
+// the consecutive pages of a process in adjacent slots with one clustered
+// request.  Pages without a slot yet go last, by process and page, their
+// runs get adjacent slots when they are written.
+//==========================================
 
+typedef struct
+{ int pid, page;
+  int slot;   // swap file slot at the flush, nullIndex if none yet
+  unsigned *buf;
+} WritebackEntry;
+
+WritebackEntry *wbQueue;
+int wbCount = 0;
+int wbScans = 0;   // age scans since the last periodic flush
+int wbPages = 0, wbWrites = 0, wbFlushes = 0;   // for statistics
+
+int writeback_compare (const void *a, const void *b)
+{ const WritebackEntry *x = a, *y = b;
+
+  if (x->slot != y->slot)
+  { if (x->slot == nullIndex) return (1);
+    if (y->slot == nullIndex) return (-1);
+    return (x->slot - y->slot);
+  }
+  if (x->pid != y->pid) return (x->pid - y->pid);
+  return (x->page - y->page);
+}
 
-	for (j = OSpages; j < numFrames; j++) {
-		if (memFrame[j].age == lowestAge && memFrame[j].dirty == cleanFrame) {
-			cleanCounter++;
-			if (cleanCounter == 1) {
-				arbitraryFrame = j;
-			}else{
-				addto_free_frame(j, pendingPage);
-			}
-		}
-	}
+void writeback_flush ()
+{ int i, j, k;
+  unsigned **bufv;
+
+  if (wbCount == 0) return;
+  for (i=0; i<wbCount; i++)
+    wbQueue[i].slot = swap_page_slot (wbQueue[i].pid, wbQueue[i].page);
+  qsort (wbQueue, wbCount, sizeof(WritebackEntry), writeback_compare);
+  for (i=0; i<wbCount; i=j)
+  { for (j=i+1; j<wbCount && wbQueue[j].pid == wbQueue[i].pid
+                && wbQueue[j].page == wbQueue[j-1].page+1
+                && (wbQueue[j].slot == nullIndex ? wbQueue[j-1].slot == nullIndex
+                    : wbQueue[j].slot == wbQueue[j-1].slot+1); j++)
+      ;
+    bufv = (unsigned **) malloc ((j-i)*sizeof(unsigned *));
+    for (k=i; k<j; k++) bufv[k-i] = wbQueue[k].buf;
+    insert_swapQ_cluster (wbQueue[i].pid, wbQueue[i].page, j-i, bufv,
+                          actWrite, freeBuf);
+    wbWrites++;
+  }
+  printf ("Writeback flush: %d pages\n", wbCount);
+  wbCount = 0;
+  wbFlushes++;
+}
 
-	if (cleanCounter == 0) {
-		for (j = OSpages; j < numFrames; j++) {
-			if (memFrame[j].age == lowestAge) {
-				//addto_free_frame(j, pendingPage);
-				arbitraryFrame = j;
-				break;
-			}
-		}
-	}
-	printf("Selected agest frame = %d, age = %x, dirty = %d\n", arbitraryFrame, memFrame[arbitraryFrame].age, memFrame[arbitraryFrame].dirty);
-	return arbitraryFrame;
+// write page of pid back to its swap page, from the content of frame findex
+void writeback_pid_page (int pid, int page, int findex)
+{ int i;
+
+  if (writebackBatch == 0)
+  { insert_swapQ (pid, page, (unsigned *) &Memory[findex << pagenumShift],
+                  actWrite, Nothing);
+    return;
+  }
+  // a page cleaned again before the flush only keeps its last content
+  for (i=0; i<wbCount; i++)
+    if (wbQueue[i].pid == pid && wbQueue[i].page == page) break;
+  if (i == wbCount)
+  { wbQueue[i].pid = pid;
+    wbQueue[i].page = page;
+    wbQueue[i].buf = (unsigned *) malloc (pageSize*sizeof(mType));
+    wbCount++;
+  }
+  memcpy (wbQueue[i].buf, &Memory[findex << pagenumShift],
+          pageSize*sizeof(mType));
+  wbPages++;
+  if (wbCount >= writebackBatch) writeback_flush ();
+}
+
+// write the page in frame findex back to its swap page
+void writeback_page (int findex)
+{ writeback_pid_page (memFrame.pid[findex], memFrame.page[findex], findex); }
+
+// called before reading pages lo..hi of pid from swap, flush if any of
+// them is still buffered
+void writeback_sync (int pid, int lo, int hi)
+{ int i;
+
+  for (i=0; i<wbCount; i++)
+    if (wbQueue[i].pid == pid && wbQueue[i].page >= lo
+        && wbQueue[i].page <= hi)
+    { writeback_flush (); return; }
+}
+
+// the buffered pages of a terminated process are not written
+void writeback_drop (int pid)
+{ int i, j = 0;
+
+  for (i=0; i<wbCount; i++)
+    if (wbQueue[i].pid == pid) free (wbQueue[i].buf);
+    else wbQueue[j++] = wbQueue[i];
+  wbCount = j;
 }
 
 
-int get_free_frame ()
+// write a dirty frame back to its swap page, the frame stays mapped
+// the write is queued (or the page copied, see batched writeback) before
+// any later read into this frame, so the frame can be reused right away
+void clean_frame (int findex)
+{
+  writeback_page(findex);
+  dirtyBits[bitWord(findex)] &= ~bitMask(findex);
+  memFrame.dirty[findex] = cleanFrame;
+  replacePolicy->on_clean(findex);
+}
+
+
+int get_free_frame (int pid, int page)
 { 
 // get a free frame from the head of the free list 
-// if there is no free frame, then get one frame with the lowest age
-// this func always returns a frame, either from free list or get one with lowest age
+// if there is no free frame, then the replacement policy selects one
+// for the faulting pid/page
+// returns a frame, either from free list or a victim, or nullIndex if no
+// frame can be replaced now (all pinned, or being filled), the fault is
+// then retried later (see page_fault_handler)
 
 //	int i;
 //	for (i = OSpages;  i < numFrames; i++) {
-//		if(memFrame[i].free == freeFrame){
+//		if(memFrame.free[i] == freeFrame){
 //			return i;
 //		}
 //	}
@@ -371,28 +607,39 @@ int get_free_frame ()
 	int i;
 
 	if(freeFhead == nullIndex && freeFtail == nullIndex){
-		return select_agest_frame();
+		fold_reference_bits();
+		if(localReplace && pid > idlePid){
+			i = local_select_victim(pid);
+			if(i != nullIndex) return i;
+		}
+		i = replacePolicy->select_victim(pid, page);
+		if(i == nullIndex)
+			printf("No replaceable frame for pid/page=(%d,%d)\n", pid, page);
+		return i;
 	}else{
-		if(memFrame[freeFhead].prev == nullIndex && memFrame[freeFhead].next != nullIndex){
+		fold_frame_bits(freeFhead);
+		if(memFrame.prev[freeFhead] == nullIndex && memFrame.next[freeFhead] != nullIndex){
 			i = freeFhead;
-			freeFhead = memFrame[freeFhead].next;
-			memFrame[i].next = nullIndex;
-			memFrame[freeFhead].prev = nullIndex;
+			freeFhead = memFrame.next[freeFhead];
+			memFrame.next[i] = nullIndex;
+			memFrame.prev[freeFhead] = nullIndex;
 
-			if(memFrame[i].age != zeroAge){
+			if(memFrame.age[i] != zeroAge){
 				printf("============= Frame got used after freed %d\n",i);
-				printf("Selected agest frame = %d, age %x, dirty %d\n",i, memFrame[i].age, memFrame[i].dirty);
+				printf("Selected agest frame = %d, age %x, dirty %d\n",i, memFrame.age[i], memFrame.dirty[i]);
 			}
+			freeFcount--;
 
 			return i;
-		}else if(memFrame[freeFhead].prev == nullIndex && memFrame[freeFhead].next == nullIndex){
+		}else if(memFrame.prev[freeFhead] == nullIndex && memFrame.next[freeFhead] == nullIndex){
 			i = freeFhead;
 			freeFhead = nullIndex;
 			freeFtail = nullIndex;
-			if(memFrame[i].age != zeroAge){
+			if(memFrame.age[i] != zeroAge){
 				printf("============= Frame got used after freed %d\n",i);
-				printf("Selected agest frame = %d, age %x, dirty %d\n",i, memFrame[i].age, memFrame[i].dirty);
+				printf("Selected agest frame = %d, age %x, dirty %d\n",i, memFrame.age[i], memFrame.dirty[i]);
 			}
+			freeFcount--;
 			return i;
 		}
 	}
@@ -400,12 +647,359 @@ int get_free_frame ()
 } 
 
 
+//==========================================
+// huge pages: hugeFactor aligned pages of a process in hugeFactor aligned
+// frames, mapped by the page table entry of the first page (frame|hugePTE),
+// the other pages of the huge page have hugeTail in the page table
+// promotion: a fault on a page whose whole huge page is on disk gets a free
+// aligned frame run, if there is one, and reads it in with one swap request
+// demotion: before a frame of a huge page is reused, the huge page becomes
+// normal pages again, so the replacement policies work on single frames
+//==========================================
+
+int hugeFaults = 0, hugeDemotions = 0;   // for statistics
+
+int pte_frame (int pid, int page, int pte)
+{
+  // resolve page table entry pte of page to the frame of the page
+  // a page being read ahead is still on disk for the address translation
+  if (pte >= 0 && (pte & aheadPTE)) return (diskPage);
+  if (pte == hugeTail)
+    pte = get_pte (pid, page & ~(hugeFactor-1)) + (page & (hugeFactor-1));
+  if (pte >= 0) pte = pte & ~hugePTE;
+  return (pte);
+}
+
+void remove_free_frame (int findex)
+{
+  // unlink findex from the middle of the free list
+  if (memFrame.prev[findex] == nullIndex) freeFhead = memFrame.next[findex];
+  else memFrame.next[memFrame.prev[findex]] = memFrame.next[findex];
+  if (memFrame.next[findex] == nullIndex) freeFtail = memFrame.prev[findex];
+  else memFrame.prev[memFrame.next[findex]] = memFrame.prev[findex];
+  memFrame.next[findex] = nullIndex;
+  memFrame.prev[findex] = nullIndex;
+  freeFcount--;
+}
+
+int get_free_run ()
+{ int run, i;
+
+  // find hugeFactor aligned free frames and take them out of the free list
+  // a linear scan, huge faults are much less frequent than accesses
+  for (run = (OSpages+hugeFactor-1) & ~(hugeFactor-1);
+       run+hugeFactor <= numFrames; run += hugeFactor)
+  { for (i=0; i<hugeFactor && memFrame.free[run+i]==freeFrame; i++)
+      ;
+    if (i == hugeFactor)
+    { for (i=0; i<hugeFactor; i++)
+      { fold_frame_bits (run+i);
+        remove_free_frame (run+i);
+      }
+      return (run);
+    }
+  }
+  return (nullIndex);
+}
+
+void demote_huge_page (int findex)
+{ int pid = memFrame.pid[findex];
+  int head = memFrame.page[findex] & ~(hugeFactor-1);
+  int run = findex - (memFrame.page[findex] & (hugeFactor-1));
+  int i;
+
+  printf("Demote huge page (%d,%d), frames %d-%d\n",
+         pid, head, run, run+hugeFactor-1);
+  for (i=0; i<hugeFactor; i++)
+  { memFrame.huge[run+i] = 0;
+    update_process_pagetable (pid, head+i, run+i);
+  }
+  hugeDemotions++;
+}
+
+// take frame findex away from its page before the frame is reused
+// a dirty frame is written back, the owner's page goes back to disk
+void evict_frame (int findex)
+{ int pid = memFrame.pid[findex];
+  int page = memFrame.page[findex];
+
+  if (pid == nullPid) return;
+  if (memFrame.huge[findex]) demote_huge_page (findex);
+  if (memFrame.ahead[findex]) readahead_waste (findex);
+  if (memFrame.merged[findex]) ksm_unshare (findex);
+  else if (memFrame.refCount[findex] > 0) unshare_text_frame (findex);
+  if (memFrame.dirty[findex] == dirtyFrame) writeback_page (findex);
+  update_process_pagetable (pid, page, diskPage);
+}
+
+int huge_page_fault (int pid, int page)
+{ int head = page & ~(hugeFactor-1);
+  int run, i;
+
+  // returns 1 if the huge page of page has been requested, 0 otherwise
+  if (hugeFactor <= 1 || head+hugeFactor > maxPpages) return (0);
+  for (i=0; i<hugeFactor; i++)
+    if (get_pte (pid, head+i) != diskPage) return (0);
+  run = get_free_run ();
+  if (run == nullIndex) return (0);
+
+  for (i=0; i<hugeFactor; i++)
+  { evict_frame (run+i);
+    update_frame_info (run+i, pid, head+i);
+    memFrame.huge[run+i] = 1;
+    update_process_pagetable (pid, head+i, (i==0)? (run|hugePTE) : hugeTail);
+  }
+  writeback_sync (pid, head, head+hugeFactor-1);
+  insert_swapQ_pages (pid, head, hugeFactor, (unsigned *) &Memory[run << pagenumShift],
+                      actRead, toReady);
+  printf("Huge page fault: pid/page=(%d,%d), frames %d-%d\n",
+         pid, head, run, run+hugeFactor-1);
+  hugeFaults++;
+  return (1);
+}
+
+
+//==========================================
+// sequential readahead: a fault on the page after the last faulted page of
+// the process doubles its readahead window (up to readaheadMax), any other
+// fault halves it.  The next raWindow pages on disk are read into free
+// frames (readahead never replaces a used frame), their page table entries
+// get frame|aheadPTE, so an access to them still faults.  A fault on such a
+// page is a readahead hit, the page is mapped without any disk IO and the
+// process only waits for an actNone request queued behind the read.
+// A read ahead frame reused before its page faults is waste, and halves
+// the window of its process.
+//==========================================
+
+int raPages = 0, raHits = 0, raWaste = 0;   // for statistics
+
+void readahead_window (int pid, int page)
+{ typePCB *p = PCB[pid];
+
+  if (page == p->lastFaultPage+1)
+  { p->raWindow = (p->raWindow == 0)? 1 : p->raWindow*2;
+    if (p->raWindow > readaheadMax) p->raWindow = readaheadMax;
+  }
+  else p->raWindow = p->raWindow/2;
+  p->lastFaultPage = page;
+}
+
+void readahead (int pid, int page)
+{ int i, frame;
+
+  for (i=page+1; i<=page+PCB[pid]->raWindow && i<maxPpages; i++)
+  { if (get_pte (pid, i) != diskPage) continue;
+    if (freeFhead == nullIndex) break;
+    frame = get_free_frame (pid, i);
+    evict_frame (frame);
+    update_frame_info (frame, pid, i);
+    memFrame.ahead[frame] = 1;
+    update_process_pagetable (pid, i, frame|aheadPTE);
+    writeback_sync (pid, i, i);
+    insert_swapQ (pid, i, (unsigned *) &Memory[frame << pagenumShift], actRead, Nothing);
+    printf("Readahead: pid/page=(%d,%d), frame %d\n", pid, i, frame);
+    raPages++;
+  }
+}
+
+int readahead_hit (int pid, int page)
+{ int pte = get_pte (pid, page);
+  int frame;
+
+  // returns 1 if page had been read ahead, 0 otherwise
+  if (pte < 0 || !(pte & aheadPTE)) return (0);
+  frame = pte & ~aheadPTE;
+  memFrame.ahead[frame] = 0;
+  update_process_pagetable (pid, page, frame);
+  insert_swapQ (pid, page, NULL, actNone, toReady);
+  printf("Readahead hit: pid/page=(%d,%d), frame %d\n", pid, page, frame);
+  raHits++;
+  return (1);
+}
+
+void readahead_waste (int findex)
+{ int pid = memFrame.pid[findex];
+
+  memFrame.ahead[findex] = 0;
+  if (PCB[pid] != NULL) PCB[pid]->raWindow = PCB[pid]->raWindow/2;
+  raWaste++;
+}
+
+//==========================================
+// working set estimate of each process: its used frames referenced in the
+// last wsWindow cycles, lastUse is set when the reference bits are folded
+// and when the frame gets its page.  Recomputed on each age scan, a newly
+// loaded process starts with the #pages it is loaded with.
+//==========================================
+
+int *wsSize;   // indexed by pid
+
+void update_working_sets ()
+{ int i;
+
+  for (i=0; i<maxProcess; i++) wsSize[i] = 0;
+  for (i=OSpages; i<numFrames; i++)
+    if (memFrame.free[i] == usedFrame && memFrame.pid[i] > idlePid
+        && CPU.numCycles - memFrame.lastUse[i] <= wsWindow)
+      wsSize[memFrame.pid[i]]++;
+}
+
+int total_working_set ()
+{ int i, total = 0;
+
+  for (i=idlePid+1; i<maxProcess; i++) total += wsSize[i];
+  return (total);
+}
+
+void dump_working_sets ()
+{ int i;
+
+  printf ("Working sets (pid:frames) = ");
+  for (i=idlePid+1; i<maxProcess; i++)
+    if (wsSize[i] > 0) printf ("%d:%d, ", i, wsSize[i]);
+  printf ("total %d of %d frames\n", total_working_set(), numFrames-OSpages);
+}
+
+//==========================================
+// local replacement (localReplace = 1): each process has a frame quota,
+// starting with the #pages it is loaded with.  On each age scan, a process
+// with more than pffHigh faults in the last period gets one more frame if
+// the quotas still fit in the user frames, one with less than pffLow faults
+// gives one back.  When memory is full, a process at its quota replaces
+// its own least recently used frame, a process below its quota takes the
+// least recently used frame of a process above its quota, the replacement
+// policy only selects when no process is above its quota.
+//==========================================
+
+int *frameQuota, *pffFaults;   // indexed by pid
+int localVictims = 0, quotaSteals = 0;   // for statistics
+
+void update_frame_quotas ()
+{ int pid, total = 0;
+
+  for (pid=idlePid+1; pid<maxProcess; pid++) total += frameQuota[pid];
+  for (pid=idlePid+1; pid<maxProcess; pid++)
+  { if (frameQuota[pid] == 0) continue;
+    if (pffFaults[pid] > pffHigh && total < numFrames-OSpages)
+    { frameQuota[pid]++; total++; }
+    else if (pffFaults[pid] < pffLow && frameQuota[pid] > 1)
+    { frameQuota[pid]--; total--; }
+    pffFaults[pid] = 0;
+  }
+}
+
+// a process above its quota, 0 if none
+int over_frame_quota ()
+{ int i;
+
+  for (i=idlePid+1; i<maxProcess; i++)
+    if (PCB[i] != NULL && PCB[i]->resident > frameQuota[i]) return (1);
+  return (0);
+}
+
+int local_select_victim (int pid)
+{ int i, owner, own = nullIndex, steal = nullIndex;
+  int atQuota = (PCB[pid]->resident >= frameQuota[pid]);
+
+  // returns nullIndex if the replacement policy should select the victim
+  // the frames are only scanned when pid is at its quota or another
+  // process is above its quota (the resident counts are in the PCBs)
+  if (!atQuota && !over_frame_quota ()) return (nullIndex);
+  for (i=OSpages; i<numFrames; i++)
+  { owner = memFrame.pid[i];
+    if (owner <= idlePid || memFrame.pinned[i] == pinnedFrame) continue;
+    if (owner == pid)
+    { if (own == nullIndex || memFrame.lastUse[i] < memFrame.lastUse[own])
+        own = i;
+    }
+    else if (PCB[owner]->resident > frameQuota[owner])
+    { if (steal == nullIndex || memFrame.lastUse[i] < memFrame.lastUse[steal])
+        steal = i;
+    }
+  }
+  if (own != nullIndex && atQuota)
+  { localVictims++; return (own); }
+  if (steal != nullIndex) { quotaSteals++; return (steal); }
+  return (nullIndex);
+}
+
+void dump_frame_quotas ()
+{ int pid;
+
+  printf ("Frame quotas (pid:quota/faults) = ");
+  for (pid=idlePid+1; pid<maxProcess; pid++)
+    if (frameQuota[pid] > 0)
+      printf ("%d:%d/%d, ", pid, frameQuota[pid], pffFaults[pid]);
+  printf ("local victims = %d, steals = %d\n", localVictims, quotaSteals);
+}
+
+//==========================================
+// page-out daemon: runs on each age scan, when there are less than
+// lowWatermark free frames, the replacement policy selects frames to put
+// to the free list till there are highWatermark free frames.  Dirty frames
+// are cleaned first (write back queued to the swap manager), so a later
+// fault finds a clean free frame and only waits for its own read.
+// The frames stay mapped (pendingPage) till they are actually reused.
+// Faults still select a victim themselves when the free list is empty.
+//==========================================
+
+int pageoutFreed = 0, pageoutCleaned = 0, pageoutRuns = 0;   // statistics
+
+void pageout_daemon ()
+{ int victim;
+
+  if (freeFcount >= lowWatermark) return;
+  pageoutRuns++;
+  // the policies need a used frame to select, pinned frames are not used
+  // (freeFcount also counts the frames the policy frees itself)
+  while (freeFcount < highWatermark && freeFcount < numFrames-OSpages)
+  { victim = replacePolicy->select_victim (nullPid, nullPage);
+    if (victim < OSpages || memFrame.free[victim] == freeFrame) break;
+    if (memFrame.dirty[victim] == dirtyFrame)
+    { clean_frame (victim);
+      pageoutCleaned++;
+    }
+    addto_free_frame (victim, pendingPage);
+    pageoutFreed++;
+  }
+  printf ("Page-out daemon: %d free frames\n", freeFcount);
+}
+
 void initialize_memory ()
 { int i;
 
-  // create memory + create page frame array memFrame 
+  // create memory + create the page frame arrays of memFrame 
   Memory = (mType *) malloc (numFrames*pageSize*sizeof(mType));
-  memFrame = (FrameStruct *) malloc (numFrames*sizeof(FrameStruct));
+  memFrame.pid = (int *) malloc (numFrames*sizeof(int));
+  memFrame.page = (int *) malloc (numFrames*sizeof(int));
+  memFrame.age = (ageType *) malloc (numFrames*sizeof(ageType));
+  memFrame.free = (char *) malloc (numFrames);
+  memFrame.dirty = (char *) malloc (numFrames);
+  memFrame.pinned = (char *) malloc (numFrames);
+  memFrame.referenced = (char *) malloc (numFrames);
+  memFrame.lastUse = (int *) malloc (numFrames*sizeof(int));
+  memFrame.next = (int *) malloc (numFrames*sizeof(int));
+  memFrame.prev = (int *) malloc (numFrames*sizeof(int));
+  memFrame.plist = (int *) malloc (numFrames*sizeof(int));
+  memFrame.pnext = (int *) malloc (numFrames*sizeof(int));
+  memFrame.pprev = (int *) malloc (numFrames*sizeof(int));
+  memFrame.huge = (char *) calloc (numFrames, 1);
+  memFrame.ahead = (char *) calloc (numFrames, 1);
+  memFrame.refCount = (int *) calloc (numFrames, sizeof(int));
+  memFrame.merged = (char *) calloc (numFrames, 1);
+  wsSize = (int *) calloc (maxProcess, sizeof(int));
+  frameQuota = (int *) calloc (maxProcess, sizeof(int));
+  pffFaults = (int *) calloc (maxProcess, sizeof(int));
+  textImage = (int *) malloc (maxProcess*sizeof(int));
+  for (i=0; i<maxProcess; i++) textImage[i] = nullIndex;
+  textFrame = (int *) malloc (maxProcess*maxPpages*sizeof(int));
+  for (i=0; i<maxProcess*maxPpages; i++) textFrame[i] = nullIndex;
+  textDiverged = (char *) calloc (maxProcess*maxPpages, 1);
+  if (writebackBatch > 0)
+    wbQueue = (WritebackEntry *) malloc (writebackBatch*sizeof(WritebackEntry));
+  bitWords = (numFrames + 31) / 32;
+  refBits = (unsigned *) calloc (bitWords, sizeof(unsigned));
+  dirtyBits = (unsigned *) calloc (bitWords, sizeof(unsigned));
 
   // compute #bits for page offset, set pagenumShift and pageoffsetMask
   // *** ADD CODE
@@ -415,43 +1009,302 @@ void initialize_memory ()
 
   // initialize OS pages
   for (i=0; i<OSpages; i++)
-  { memFrame[i].age = zeroAge;
-    memFrame[i].dirty = cleanFrame;
-    memFrame[i].free = usedFrame;
-    memFrame[i].pinned = pinnedFrame;
-    memFrame[i].pid = osPid;
+  { memFrame.age[i] = zeroAge;
+    memFrame.dirty[i] = cleanFrame;
+    memFrame.free[i] = usedFrame;
+    memFrame.pinned[i] = pinnedFrame;
+    memFrame.pid[i] = osPid;
+    memFrame.referenced[i] = 0;
+    memFrame.lastUse[i] = 0;
+    memFrame.plist[i] = nullIndex;
   }
   // initilize the remaining pages, also put them in free list
   // *** ADD CODE
 
   for (i=OSpages; i<numFrames; i++)
-    { memFrame[i].age = zeroAge;
-      memFrame[i].dirty = cleanFrame;
-      memFrame[i].free = freeFrame;
-      memFrame[i].pinned = nopinFrame;
-      memFrame[i].pid = nullPid;
-      memFrame[i].page = nullPage;
-      memFrame[i].next = i+1;
+    { memFrame.age[i] = zeroAge;
+      memFrame.dirty[i] = cleanFrame;
+      memFrame.free[i] = freeFrame;
+      memFrame.pinned[i] = nopinFrame;
+      memFrame.pid[i] = nullPid;
+      memFrame.page[i] = nullPage;
+      memFrame.referenced[i] = 0;
+      memFrame.lastUse[i] = 0;
+      memFrame.plist[i] = nullIndex;
+      memFrame.next[i] = i+1;
       if( i == numFrames-1 ){
-    	  memFrame[i].next = -1;
+    	  memFrame.next[i] = -1;
       }
-      memFrame[i].prev = i-1;
+      memFrame.prev[i] = i-1;
       if( i == OSpages ){
-    	  memFrame[i].prev = -1;
+    	  memFrame.prev[i] = -1;
       }
     }
 
   freeFhead = OSpages;
   freeFtail = numFrames-1;
+  freeFcount = numFrames-OSpages;
 }
 
 //==========================================
 // process page table manamgement
 //==========================================
 
+// the page table of a process is reached from PCB[pid]->PTptr
+// ptMode=flatPT: PTptr is an array of maxPpages entries
+// ptMode=radixPT: PTptr is the root node of a radix tree with ptLevels
+//   levels of ptFanout entries each, a node is allocated when the first
+//   entry under it is set and freed when its last entry goes back to null
+//   so the page table grows with the pages the process has (in memory or
+//   on disk) instead of with maxPpages
+// ptMode=invertedPT: PTptr is the swap bitmap of the process, the frames
+//   are found in the global inverted page table IPT (see below)
+// the rest of paging.c only uses get_pte / set_pte / walk_pagetable
+
+typedef struct PTnodeStruct
+{ int count;   // #entries that are not nullPage (leaf) or not NULL (inner)
+  union
+  { int frame;   // leaf level: frame number, nullPage or diskPage
+    struct PTnodeStruct *child;   // inner levels: next level node
+  } entry[];
+} PTnode;
+
+#define maxPTlevels 32
+
+int ptLevels, ptShift;   // ptFanout = 1 << ptShift
+int ptNodes = 0;   // #radix nodes currently allocated, for statistics
+
+PTnode *new_ptnode (int leaf)
+{ PTnode *node;
+  int i;
+
+  node = (PTnode *) malloc (sizeof(PTnode) + ptFanout*sizeof(node->entry[0]));
+  node->count = 0;
+  for (i=0; i<ptFanout; i++)
+    if (leaf) node->entry[i].frame = nullPage;
+    else node->entry[i].child = NULL;
+  ptNodes++;
+  return (node);
+}
+
+// ptMode=invertedPT: one global hash table maps (pid,page) to the frame,
+// open addressing with linear probing, iptSize is a power of 2 and at
+// least 2*numFrames, so the table is bounded by the physical memory
+// whatever the #processes is.  Pages on disk are not in the hash, each
+// process only keeps a bitmap of its swapped pages in PTptr (1 bit/page)
+
+typedef struct
+{ int pid, page, frame;   // slot is empty when pid is nullPid
+} IPTentry;
+
+IPTentry *IPT;
+int iptSize, iptMask;
+int iptEntries = 0;
+int iptLookups = 0, iptProbes = 0;   // for statistics
+
+int ipt_hash (int pid, int page)
+{ return (((unsigned)pid * 2654435761u + (unsigned)page) & iptMask); }
+
+// return the slot of (pid,page), or the empty slot ending its probe chain
+int ipt_slot (int pid, int page)
+{ int i;
+
+  iptLookups++;
+  for (i=ipt_hash(pid,page); IPT[i].pid!=nullPid; i=(i+1)&iptMask)
+  { iptProbes++;
+    if (IPT[i].pid == pid && IPT[i].page == page) break;
+  }
+  return (i);
+}
+
+// remove slot i, move the later entries of the chain back to fill the hole
+void ipt_delete (int i)
+{ int j, home;
+
+  IPT[i].pid = nullPid;
+  iptEntries--;
+  for (j=(i+1)&iptMask; IPT[j].pid!=nullPid; j=(j+1)&iptMask)
+  { home = ipt_hash (IPT[j].pid, IPT[j].page);
+    // move j to i if home is not cyclically in (i,j]
+    if (((j - home) & iptMask) >= ((j - i) & iptMask))
+    { IPT[i] = IPT[j];
+      IPT[j].pid = nullPid;
+      i = j;
+    }
+  }
+}
+
+void ipt_set (int pid, int page, int frame)
+{ unsigned *swapmap = (unsigned *) PCB[pid]->PTptr;
+  int i = ipt_slot (pid, page);
+
+  // a frame maps one page (no shared frames), so the hash holds at most
+  // numFrames entries and cannot fill; if it does, stop before the page
+  // loses both its frame and its swap bit
+  if (frame != nullPage && frame != diskPage && IPT[i].pid == nullPid
+      && iptEntries >= iptSize-1)
+  { printf ("Error: inverted page table is full, (%d,%d) not mapped\n",
+            pid, page);
+    exit(-1);
+  }
+
+  if (frame == diskPage) swapmap[bitWord(page)] |= bitMask(page);
+  else swapmap[bitWord(page)] &= ~bitMask(page);
+
+  if (frame == nullPage || frame == diskPage)
+  { if (IPT[i].pid != nullPid) ipt_delete (i);
+    return;
+  }
+  if (IPT[i].pid == nullPid)
+  { IPT[i].pid = pid; IPT[i].page = page;
+    iptEntries++;
+  }
+  IPT[i].frame = frame;
+}
+
+int ipt_get (int pid, int page)
+{ unsigned *swapmap = (unsigned *) PCB[pid]->PTptr;
+  int i = ipt_slot (pid, page);
+
+  if (IPT[i].pid != nullPid) return (IPT[i].frame);
+  if (swapmap[bitWord(page)] & bitMask(page)) return (diskPage);
+  return (nullPage);
+}
+
+// drop all the hash entries of process pid
+void ipt_free_process (int pid)
+{ int i;
+
+  // ipt_delete may move an entry into slot i, so check i again
+  for (i=0; i<iptSize; )
+    if (IPT[i].pid == pid) ipt_delete (i);
+    else i++;
+}
+
+void initialize_pagetable_mode ()
+{ int pages, i;
+
+  if (ptMode == invertedPT)
+  { for (iptSize=2; iptSize < 2*numFrames; iptSize = iptSize << 1)
+      ;
+    iptMask = iptSize - 1;
+    IPT = (IPTentry *) malloc (iptSize*sizeof(IPTentry));
+    for (i=0; i<iptSize; i++) IPT[i].pid = nullPid;
+    printf ("Inverted page table: %d slots\n", iptSize);
+    // the hash is sized by the frames, a shared frame maps several pages
+    if (shareText || ksmPages > 0)
+    { printf ("Shared frames are off with the inverted page table\n");
+      shareText = 0; ksmPages = 0;
+    }
+    return;
+  }
+  if (ptMode != radixPT) return;
+  // round ptFanout up to a power of 2, then find the #levels to cover
+  // maxPpages pages
+  for (ptShift=1; (1<<ptShift) < ptFanout; ptShift++);
+  ptFanout = 1 << ptShift;
+  ptLevels = 1; pages = ptFanout;
+  while (pages < maxPpages && ptLevels < maxPTlevels)
+  { pages = pages << ptShift; ptLevels++; }
+  printf ("Radix page table: %d levels of %d entries\n", ptLevels, ptFanout);
+}
+
+int pt_index (int page, int level)
+{ return ((page >> (level*ptShift)) & (ptFanout-1)); }
+
+int get_pte (int pid, int page)
+{ PTnode *node;
+  int level;
+
+  if (ptMode == flatPT) return (PCB[pid]->PTptr[page]);
+  if (ptMode == invertedPT) return (ipt_get (pid, page));
+  node = (PTnode *) PCB[pid]->PTptr;
+  for (level=ptLevels-1; level>0 && node!=NULL; level--)
+    node = node->entry[pt_index(page,level)].child;
+  if (node == NULL) return (nullPage);
+  return (node->entry[pt_index(page,0)].frame);
+}
+
+void set_pte (int pid, int page, int frame)
+{ PTnode *path[maxPTlevels];
+  PTnode *node;
+  int level, idx;
+
+  if (ptMode == flatPT) { PCB[pid]->PTptr[page] = frame; return; }
+  if (ptMode == invertedPT) { ipt_set (pid, page, frame); return; }
+
+  // walk down, allocate the missing nodes unless we are clearing the entry
+  node = (PTnode *) PCB[pid]->PTptr;
+  for (level=ptLevels-1; level>=0; level--)
+  { path[level] = node;
+    if (level == 0) break;
+    idx = pt_index(page,level);
+    if (node->entry[idx].child == NULL)
+    { if (frame == nullPage) return;
+      node->entry[idx].child = new_ptnode (level == 1);
+      node->count++;
+    }
+    node = node->entry[idx].child;
+  }
+
+  idx = pt_index(page,0);
+  if (node->entry[idx].frame == nullPage && frame != nullPage) node->count++;
+  else if (node->entry[idx].frame != nullPage && frame == nullPage)
+    node->count--;
+  node->entry[idx].frame = frame;
+
+  // free the emptied nodes bottom up, the root stays
+  for (level=0; level<ptLevels-1 && path[level]->count==0; level++)
+  { free (path[level]); ptNodes--;
+    path[level+1]->entry[pt_index(page,level+1)].child = NULL;
+    path[level+1]->count--;
+  }
+}
+
+// call visit(pid,page,frame) for each page table entry that is not nullPage
+// the radix walk only visits the allocated nodes
+
+void walk_ptnode (int pid, PTnode *node, int level, int base,
+                  void (*visit)(int pid, int page, int frame))
+{ int i;
+
+  for (i=0; i<ptFanout; i++)
+    if (level == 0)
+    { if (node->entry[i].frame != nullPage)
+        visit (pid, base+i, node->entry[i].frame);
+    }
+    else if (node->entry[i].child != NULL)
+      walk_ptnode (pid, node->entry[i].child, level-1,
+                   base + (i << (level*ptShift)), visit);
+}
+
+void walk_pagetable (int pid, void (*visit)(int pid, int page, int frame))
+{ int i, frame;
+
+  if (ptMode == flatPT)
+  { for (i=0; i<maxPpages; i++)
+      if (PCB[pid]->PTptr[i] != nullPage) visit (pid, i, PCB[pid]->PTptr[i]);
+  }
+  else if (ptMode == invertedPT)
+  { for (i=0; i<maxPpages; i++)
+    { frame = ipt_get (pid, i);
+      if (frame != nullPage) visit (pid, i, frame);
+    }
+  }
+  else walk_ptnode (pid, (PTnode *) PCB[pid]->PTptr, ptLevels-1, 0, visit);
+}
+
 void init_process_pagetable (int pid)
 { int i;
 
+  if (ptMode == radixPT)
+  { PCB[pid]->PTptr = (int *) new_ptnode (ptLevels == 1);
+    return;
+  }
+  if (ptMode == invertedPT)
+  { PCB[pid]->PTptr = (int *) calloc (bitWord(maxPpages-1)+1, sizeof(unsigned));
+    return;
+  }
   PCB[pid]->PTptr = (int *) malloc (addrSize*maxPpages);
   for (i=0; i<maxPpages; i++) PCB[pid]->PTptr[i] = nullPage;
 }
@@ -464,65 +1317,126 @@ int pid, page, frame;
   // update the page table entry for process pid to point to the frame
   // or point to disk or null
 	printf("PT update for (%d,%d) to %d\n",pid,page,frame);
-	PCB[pid]->PTptr[page] = frame;
+	set_pte(pid, page, frame);
+	tlb_invalidate(pid, page);
 }
 
 
+void free_page_frame (int pid, int page, int frame)
+{
+	// a shared text frame is only freed with the last page table mapping it
+	if(frame != diskPage && memFrame.refCount[frame] > 0
+	   && drop_shared_frame(pid, page, frame)) return;
+	// the frame may have been freed and reused by another process
+	if(frame != diskPage && memFrame.pid[frame] == pid
+	   && memFrame.page[frame] == page){
+		if(memFrame.free[frame] != freeFrame){
+			addto_free_frame(frame, nullPage);
+		}else{
+			// already in free list, only drop the ownership
+			clear_frame_bits(frame);
+			set_frame_owner(frame, nullPid);
+			memFrame.page[frame] = nullPage;
+			memFrame.dirty[frame] = cleanFrame;
+			memFrame.huge[frame] = 0;
+			memFrame.ahead[frame] = 0;
+		}
+	}
+}
+
+void free_one_page (int pid, int page, int frame)
+{ int i;
+
+	// a huge page is freed through its first page
+	if(frame == hugeTail) return;
+	if(frame >= 0 && (frame & hugePTE)){
+		frame = frame & ~hugePTE;
+		for (i=0; i<hugeFactor; i++) free_page_frame(pid, page+i, frame+i);
+	}
+	else if(frame >= 0) free_page_frame(pid, page, frame & ~aheadPTE);
+}
+
+void free_ptnode (PTnode *node, int level)
+{ int i;
+
+  if (level > 0)
+    for (i=0; i<ptFanout; i++)
+      if (node->entry[i].child != NULL)
+        free_ptnode (node->entry[i].child, level-1);
+  free (node); ptNodes--;
+}
+
 int free_process_memory (int pid)
 { 
   // free the memory frames for a terminated process
   // some frames may have already been freed, but still in process pagetable
 	printf("Free frames allocated to process %d\n",pid);
-	int i;
-	for (i=0; i<maxPpages; i++){
-		if(PCB[pid]->PTptr[i] != nullPage){
-			if(PCB[pid]->PTptr[i] !=diskPage){
-				if(memFrame[PCB[pid]->PTptr[i]].free != freeFrame){
-					addto_free_frame(PCB[pid]->PTptr[i], nullPage);
-				}
-			}
-			PCB[pid]->PTptr[i] = nullPage;
-		}
+	tlb_flush_process(pid);
+	walk_pagetable(pid, free_one_page);
+	writeback_drop(pid);
+	insert_swapQ(pid, 0, NULL, actDrop, Nothing);   // after its queued writes
+	textImage[pid] = nullIndex;
+	memset(&textDiverged[pid*maxPpages], 0, maxPpages);
+	wsSize[pid] = 0;
+	frameQuota[pid] = 0;
+	pffFaults[pid] = 0;
+	if(ptMode == radixPT) free_ptnode((PTnode *) PCB[pid]->PTptr, ptLevels-1);
+	else{
+		if(ptMode == invertedPT) ipt_free_process(pid);
+		free(PCB[pid]->PTptr);
 	}
+	PCB[pid]->PTptr = NULL;
 	return pid;
 }
 
 
+void print_one_pte (int pid, int page, int frame)
+{ if(frame >= 0 && (frame & hugePTE)) printf("%d:%dH, ",page,frame & ~hugePTE);
+  else printf("%d:%d, ",page,frame); }
+
 void dump_process_pagetable (int pid)
 { 
   // print page table entries of process pid
 	printf ("******************** Page Table Dump for Process %d\n",pid);
 	int i;
 	int count = 0;
+	if(ptMode != flatPT){
+		// only the allocated entries, as page:frame
+		walk_pagetable(pid, print_one_pte);
+		printf("\n");
+		return;
+	}
 	for (i=0; i<maxPpages; i++){
 		if(count == pageSize){
 			printf("\n");
 		}
-		printf("%d, ",PCB[pid]->PTptr[i]);
+		if(PCB[pid]->PTptr[i] >= 0 && (PCB[pid]->PTptr[i] & hugePTE))
+			printf("%dH, ",PCB[pid]->PTptr[i] & ~hugePTE);
+		else printf("%d, ",PCB[pid]->PTptr[i]);
 		count++;
 	}
 	printf("\n");
 }
 
 
+void dump_one_page (int pid, int page, int frame)
+{
+	frame = pte_frame(pid, page, frame);
+	if(frame != diskPage){
+		printf("***P/F:%d,%d: ",page,frame);
+		print_one_frameinfo(frame);
+		dump_one_frame(frame);
+	}else{
+		printf("***P/F:%d,%d: ",page,diskPage);
+		dump_process_swap_page(pid,page);
+	}
+}
+
 void dump_process_memory (int pid)
 { 
   // print out the memory content for process pid
-	int i;
 	printf("******************** Memory Dump for Process %d\n",pid);
-	for (i=0; i<maxPpages; i++){
-			if(PCB[pid]->PTptr[i] != nullPage && PCB[pid]->PTptr[i] !=diskPage){
-					printf("***P/F:%d,%d: ",i,PCB[pid]->PTptr[i]);
-					print_one_frameinfo(PCB[pid]->PTptr[i]);
-					dump_one_frame(PCB[pid]->PTptr[i]);
-			}else if(PCB[pid]->PTptr[i] == diskPage){
-					printf("***P/F:%d,%d: ",i,diskPage);
-					dump_process_swap_page(pid,i);
-			}else if(PCB[pid]->PTptr[i] == nullPage){
-				printf("***P/F:%d,%d: \n",i,nullPage);
-			}
-		}
-
+	walk_pagetable(pid, dump_one_page);
 }
 
 //==========================================
@@ -535,77 +1449,545 @@ void dump_process_memory (int pid)
 #define actWrite 1
 
 
+// fault clustering: the pages of a process are mostly in consecutive swap
+// slots (a page gets the slot after the one of the page before it)
+// so the pages on disk next to the faulting page are brought in with it,
+// into free frames only, and all of them are read by one request
+
+int clusterFaults = 0, clusterPages = 0;   // for statistics
+
+int swap_in_cluster (int pid, int page, int frame)
+{ int lo = page, hi = page;
+  int n, f, i;
+  unsigned **bufv;
+
+  // frame is already mapped to page, returns 0 if there is no neighbor
+  for (n=0, f=freeFhead; f!=nullIndex && n<faultCluster-1; f=memFrame.next[f])
+    n++;
+  while (n > 0 && hi+1 < maxPpages && get_pte (pid, hi+1) == diskPage)
+  { hi++; n--; }
+  while (n > 0 && lo > 0 && get_pte (pid, lo-1) == diskPage)
+  { lo--; n--; }
+  if (lo == hi) return (0);
+
+  bufv = (unsigned **) malloc ((hi-lo+1)*sizeof(unsigned *));
+  for (i=lo; i<=hi; i++)
+  { if (i == page) f = frame;
+    else
+    { f = get_free_frame (pid, i);
+      evict_frame (f);
+      update_frame_info (f, pid, i);
+      update_process_pagetable (pid, i, f);
+    }
+    bufv[i-lo] = (unsigned *) &Memory[f << pagenumShift];
+  }
+  writeback_sync (pid, lo, hi);
+  insert_swapQ_cluster (pid, lo, hi-lo+1, bufv, actRead, toReady);
+  printf("Fault cluster: pid/pages=(%d,%d-%d)\n", pid, lo, hi);
+  clusterFaults++;
+  clusterPages += hi-lo;
+  return (1);
+}
+
+// demand zero: the first write to a page that does not exist yet (nullPage)
+// gets a zero filled frame, there is nothing to read from swap.  The frame
+// is zeroed in place and the faulting process goes back to the ready queue
+// right away, unless the frame still has a request in the swap queue (e.g.,
+// the write of its old page), then it is zeroed by an actCopy request
+// queued behind it and the process waits only for that.  The frame is
+// dirty, a zero page replaced before its write is written
+
+int zeroFaults = 0;   // for statistics
+int frameRetries = 0;   // faults retried, no replaceable frame
+
+// get a frame for page, to be filled without disk IO (zero fill, copy on write)
+// nullIndex if there is none now
+int get_fill_frame (int pid, int page)
+{ int frame = get_free_frame(pid, page);
+
+  if (frame == nullIndex) return (nullIndex);
+  evict_frame(frame);
+  update_frame_info(frame, pid, page);
+  return (frame);
+}
+
+// returns 0 if the frame is zeroed already (or there is no frame now and
+// the fault is retried), 1 if pid waits for the queue
+int zero_fill_page (int pid, int page)
+{ int frame = get_fill_frame(pid, page);
+  int queued;
+
+  if (frame == nullIndex) { frameRetries++; return (0); }
+  refBits[bitWord(frame)] |= bitMask(frame);
+  dirtyBits[bitWord(frame)] |= bitMask(frame);
+  update_process_pagetable(pid, page, frame);
+  queued = insert_swapQ_copy(pid, page, (unsigned *) &Memory[frame << pagenumShift], NULL, toReady);
+  printf("Zero fill: pid/page=(%d,%d), frame %d%s\n", pid, page, frame,
+         queued ? ", queued" : "");
+  zeroFaults++;
+  return (queued);
+}
+
+//==========================================
+// shared program text (shareText = 1): the text pages of the processes
+// loaded from the same program image (see loader.c) share one frame.
+// textFrame[image][page] is the frame of a text page, the refCount of the
+// frame is the #page tables mapping it, memFrame.pid is one of them.
+// The first fault on a text page reads it from the process's own swap
+// copy and makes the frame shared, a later fault of another process only
+// maps it, and waits behind the read with an actNone request.
+// A write to a shared frame faults (copy on write): the process gets a
+// private copy, or the frame itself if no other page table maps it, the
+// copy is made like the zero fill (in place, or by an actCopy request if
+// either frame is still in the swap queue); a process getting the frame
+// itself waits behind the earlier requests.
+// Shared frames are never dirty, replacing one unmaps it from all the
+// page tables mapping it.
+// A text page written by a process (copy on write) has diverged from the
+// image (e.g., data on the last text page), it is private to the process
+// from then on: its swap copy is its own content, so it is neither mapped
+// to nor published as the shared frame (textDiverged, see text_page).
+//==========================================
+
+int sharedMaps = 0, sharedFaults = 0;   // for statistics
+int cowFaults = 0, cowCopies = 0;
+
+#define text_slot(pid,page) (textImage[pid]*maxPpages + (page))
+
+int text_page (int pid, int page)
+{ return (textImage[pid] != nullIndex
+          && page < image_text_pages (textImage[pid])
+          && !textDiverged[pid*maxPpages + page]); }
+
+// frame has just been given text page of pid, share it if it is the first
+void share_text_frame (int pid, int page, int frame)
+{
+  if (!text_page (pid, page) || textFrame[text_slot(pid,page)] != nullIndex)
+    return;
+  textFrame[text_slot(pid,page)] = frame;
+  memFrame.refCount[frame] = 1;
+}
+
+// returns 1 if page is mapped to its shared frame, 0 if it has to be read
+// finishact toReady sends pid to the ready queue after the earlier requests
+int map_shared_text (int pid, int page, int finishact)
+{ int frame;
+
+  if (!text_page (pid, page) || get_pte (pid, page) != diskPage) return (0);
+  frame = textFrame[text_slot(pid,page)];
+  if (frame == nullIndex) return (0);
+  // taken by the page-out daemon but not reused yet, use it again
+  if (memFrame.free[frame] == freeFrame)
+  { remove_free_frame (frame);
+    memFrame.free[frame] = usedFrame;
+    memFrame.age[frame] = highestAge;
+    replacePolicy->on_fault (frame);
+  }
+  memFrame.refCount[frame]++;
+  update_process_pagetable (pid, page, frame);
+  if (finishact == toReady) insert_swapQ (pid, page, NULL, actNone, toReady);
+  printf("Shared text: pid/page=(%d,%d), frame %d, %d page tables\n",
+         pid, page, frame, memFrame.refCount[frame]);
+  sharedMaps++;
+  return (1);
+}
+
+// pid is going to stop mapping the shared frame, returns 1 if the frame
+// stays shared (another process may have to own it), 0 if pid was the last
+// one mapping it, the frame is then private to pid
+int drop_shared_frame (int pid, int page, int frame)
+{ int i;
+
+  if (memFrame.merged[frame]) return (ksm_drop (pid, page, frame));
+
+  if (memFrame.refCount[frame] == 1)
+  { textFrame[text_slot(pid,page)] = nullIndex;
+    memFrame.refCount[frame] = 0;
+    return (0);
+  }
+  memFrame.refCount[frame]--;
+  if (memFrame.pid[frame] == pid)
+    for (i=idlePid+1; i<maxProcess; i++)
+      if (i != pid && textImage[i] == textImage[pid]
+          && get_pte (i, page) == frame)
+      { set_frame_owner (frame, i); break; }
+  return (1);
+}
+
+// the shared frame is going to be reused, unmap it from the processes
+// other than its owner, evict_frame takes care of the owner
+void unshare_text_frame (int findex)
+{ int owner = memFrame.pid[findex];
+  int page = memFrame.page[findex];
+  int i;
+
+  for (i=idlePid+1; i<maxProcess; i++)
+    if (i != owner && textImage[i] == textImage[owner]
+        && get_pte (i, page) == findex)
+      update_process_pagetable (i, page, diskPage);
+  textFrame[text_slot(owner,page)] = nullIndex;
+  memFrame.refCount[findex] = 0;
+}
+
+// returns 0 if the copy is done already, 1 if pid waits for the queue
+int copy_on_write (int pid, int page, int frame)
+{ int copy, queued = 1;
+
+  cowFaults++;
+  textDiverged[pid*maxPpages + page] = 1;   // private from now on
+  if (!drop_shared_frame (pid, page, frame)) copy = frame;
+  else
+  { // the shared frame itself may be selected, its content is still there
+    // (so there is always a replaceable frame here)
+    copy = get_fill_frame (pid, page);
+    update_process_pagetable (pid, page, copy);
+    cowCopies++;
+  }
+  if (copy != frame)
+    queued = insert_swapQ_copy (pid, page,
+                                (unsigned *) &Memory[copy << pagenumShift],
+                                (unsigned *) &Memory[frame << pagenumShift],
+                                toReady);
+  else insert_swapQ (pid, page, NULL, actNone, toReady);
+  printf("Copy on write: pid/page=(%d,%d), frame %d to %d\n",
+         pid, page, frame, copy);
+  return (queued);
+}
+
+//==========================================
+// same page merging (ksmPages > 0): on each age scan, the scanner checks
+// the next ksmPages frames, a private frame with the same content as a
+// merged frame is merged into it, one with the same content as a frame
+// seen earlier in this pass makes that frame a merged frame first.
+// A merged frame is shared the same way as program text (refCount and
+// copy on write), the pages mapping it are its owner (memFrame.pid/page)
+// and the ksmRmap list.  It is cleaned when it is merged, and the swap
+// copy of a dirty page merged into it is written from it, so it is never
+// written back.  Frames of a process waiting for a page are not checked,
+// they may still be read into.
+//==========================================
+
+typedef struct KsmRmapStruct
+{ int pid, page;
+  struct KsmRmapStruct *next;
+} KsmRmap;
+
+KsmRmap **ksmRmap;   // [frame], the pages mapping it other than its owner
+unsigned *ksmHash;   // [frame], content hash of a merged or seen frame
+int *ksmNext, *seenNext;   // [frame], hash chains of merged / seen frames
+int *ksmBucket, *seenBucket;   // heads of the hash chains
+int *seenPid, *seenPage;   // [frame], page of the frame when it was seen
+int ksmBuckets;   // power of 2
+int ksmCursor = 0;   // next frame to check
+int ksmPasses = 0, ksmMerges = 0, ksmSaved = 0;   // for statistics
+
+unsigned ksm_hash_frame (int findex)
+{ unsigned *p = (unsigned *) &Memory[findex << pagenumShift];
+  unsigned h = 2166136261u;
+  int i;
+
+  for (i=0; i<pageSize; i++) h = (h ^ p[i]) * 16777619u;
+  return (h);
+}
+
+int same_frame_content (int a, int b)
+{ return (memcmp (&Memory[a << pagenumShift], &Memory[b << pagenumShift],
+                  pageSize*sizeof(mType)) == 0); }
+
+int ksm_candidate (int findex)
+{ int pid = memFrame.pid[findex];
+  int status;
+
+  if (memFrame.free[findex] == freeFrame || pid <= idlePid
+      || memFrame.pinned[findex] == pinnedFrame || memFrame.huge[findex]
+      || memFrame.ahead[findex] || memFrame.refCount[findex] > 0)
+    return (0);
+  status = (pid == CPU.Pid)? CPU.exeStatus : PCB[pid]->exeStatus;
+  return (status != ePFault);
+}
+
+// remove the merged frame from the hash, the frame is private again
+void ksm_unstable (int findex)
+{ int *p = &ksmBucket[ksmHash[findex] & (ksmBuckets-1)];
+
+  while (*p != findex) p = &ksmNext[*p];
+  *p = ksmNext[findex];
+  memFrame.merged[findex] = 0;
+  memFrame.refCount[findex] = 0;
+}
+
+// same as drop_shared_frame, for a merged frame
+int ksm_drop (int pid, int page, int frame)
+{ KsmRmap **p, *r;
+
+  if (memFrame.refCount[frame] == 1)
+  { ksm_unstable (frame);
+    return (0);
+  }
+  memFrame.refCount[frame]--;
+  ksmSaved--;
+  if (memFrame.pid[frame] == pid && memFrame.page[frame] == page)
+  { r = ksmRmap[frame];
+    ksmRmap[frame] = r->next;
+    set_frame_owner (frame, r->pid);
+    memFrame.page[frame] = r->page;
+    free (r);
+    return (1);
+  }
+  for (p=&ksmRmap[frame]; *p!=NULL; p=&(*p)->next)
+    if ((*p)->pid == pid && (*p)->page == page)
+    { r = *p; *p = r->next; free (r); break; }
+  return (1);
+}
+
+// same as unshare_text_frame, for a merged frame
+void ksm_unshare (int findex)
+{ KsmRmap *r;
+
+  while (ksmRmap[findex] != NULL)
+  { r = ksmRmap[findex];
+    ksmRmap[findex] = r->next;
+    update_process_pagetable (r->pid, r->page, diskPage);
+    free (r);
+    ksmSaved--;
+  }
+  ksm_unstable (findex);
+}
+
+// make frame findex with content hash h a merged frame
+void ksm_stabilize (int findex, unsigned h)
+{
+  fold_frame_bits (findex);
+  if (memFrame.dirty[findex] == dirtyFrame) clean_frame (findex);
+  memFrame.merged[findex] = 1;
+  memFrame.refCount[findex] = 1;
+  ksmHash[findex] = h;
+  ksmNext[findex] = ksmBucket[h & (ksmBuckets-1)];
+  ksmBucket[h & (ksmBuckets-1)] = findex;
+}
+
+// map the page of frame findex to the merged frame k, free findex
+void ksm_merge (int k, int findex)
+{ int pid = memFrame.pid[findex];
+  int page = memFrame.page[findex];
+  KsmRmap *r;
+
+  fold_frame_bits (findex);
+  if (memFrame.dirty[findex] == dirtyFrame) writeback_pid_page (pid, page, k);
+  r = (KsmRmap *) malloc (sizeof(KsmRmap));
+  r->pid = pid; r->page = page;
+  r->next = ksmRmap[k];
+  ksmRmap[k] = r;
+  memFrame.refCount[k]++;
+  update_process_pagetable (pid, page, k);
+  addto_free_frame (findex, nullPage);
+  printf("Same page merge: pid/page=(%d,%d), frame %d into %d\n",
+         pid, page, findex, k);
+  ksmMerges++;
+  ksmSaved++;
+}
+
+void ksm_new_pass ()
+{ int i;
+
+  for (i=0; i<ksmBuckets; i++) seenBucket[i] = nullIndex;
+  ksmCursor = OSpages;
+  ksmPasses++;
+}
+
+void ksm_scan ()
+{ int n, f, k;
+  unsigned h;
+
+  for (n=0; n<ksmPages; n++)
+  { if (ksmCursor >= numFrames) ksm_new_pass ();
+    f = ksmCursor++;
+    if (!ksm_candidate (f)) continue;
+    h = ksm_hash_frame (f);
+    for (k=ksmBucket[h & (ksmBuckets-1)]; k!=nullIndex; k=ksmNext[k])
+      if (ksmHash[k] == h && memFrame.free[k] == usedFrame
+          && same_frame_content (k, f)) break;
+    if (k != nullIndex) { ksm_merge (k, f); continue; }
+    // a seen frame may have changed or been reused since
+    for (k=seenBucket[h & (ksmBuckets-1)]; k!=nullIndex; k=seenNext[k])
+      if (ksmHash[k] == h && ksm_candidate (k) && memFrame.pid[k] == seenPid[k]
+          && memFrame.page[k] == seenPage[k] && same_frame_content (k, f))
+        break;
+    if (k != nullIndex)
+    { ksm_stabilize (k, h);
+      ksm_merge (k, f);
+      continue;
+    }
+    ksmHash[f] = h;
+    seenPid[f] = memFrame.pid[f];
+    seenPage[f] = memFrame.page[f];
+    seenNext[f] = seenBucket[h & (ksmBuckets-1)];
+    seenBucket[h & (ksmBuckets-1)] = f;
+  }
+}
+
+void initialize_ksm ()
+{ int i;
+
+  for (ksmBuckets=2; ksmBuckets < numFrames; ksmBuckets = ksmBuckets << 1);
+  ksmRmap = (KsmRmap **) calloc (numFrames, sizeof(KsmRmap *));
+  ksmHash = (unsigned *) malloc (numFrames*sizeof(unsigned));
+  ksmNext = (int *) malloc (numFrames*sizeof(int));
+  seenNext = (int *) malloc (numFrames*sizeof(int));
+  seenPid = (int *) malloc (numFrames*sizeof(int));
+  seenPage = (int *) malloc (numFrames*sizeof(int));
+  ksmBucket = (int *) malloc (ksmBuckets*sizeof(int));
+  seenBucket = (int *) malloc (ksmBuckets*sizeof(int));
+  for (i=0; i<ksmBuckets; i++) ksmBucket[i] = nullIndex;
+  ksm_new_pass ();
+  ksmPasses = 0;
+}
+
+// bring page of pid into a free frame or a replaced one
+// returns 0 if there is no frame now, the fault is retried
+int swap_in_page (int pid, int page)
+{
+	int availableFrame = get_free_frame(pid, page);
+	if(availableFrame == nullIndex){ frameRetries++; return 0; }
+	printf("Got free frame = %d\n",availableFrame);
+	dump_memoryframe_info();
+	int addr = availableFrame << pagenumShift;
+	int id = memFrame.pid[availableFrame];
+	int pageno = memFrame.page[availableFrame];
+
+	evict_frame(availableFrame);
+	update_frame_info(availableFrame, pid, page);
+	update_process_pagetable(pid, page, availableFrame);
+	if(faultCluster <= 1 || !swap_in_cluster(pid, page, availableFrame)){
+		writeback_sync(pid, page, page);
+		insert_swapQ(pid, page, &Memory[addr], actRead, toReady);
+	}
+	share_text_frame(pid, page, availableFrame);
+	printf("Swap_in: in=(%d,%d,%x), out=(%d,%d,%x), m=%x\n",pid,page,&Memory[addr],id,pageno,&Memory[addr],&Memory[0]);
+	printf("Page Fault Handler: pid/page=(%d,%d)\n",pid,page);
+	return 1;
+}
+
 void page_fault_handler ()
 { 
   // handle page fault
   // obtain a free frame or get a frame with the lowest age
   // if the frame is dirty, insert a write request to swapQ 
   // insert a read request to swapQ to bring the new page to this frame
+  // or bring in the whole huge page of the faulting page (huge_page_fault)
+  // a page already read ahead only needs mapping (readahead_hit)
+  // a page that does not exist yet gets a zeroed frame (zero_fill_page)
+  // a shared text page is mapped (map_shared_text) or copied on a write
   // update the frame metadata and the page tables of the involved processes
-
-	int availableFrame = get_free_frame();
-	printf("Got free frame = %d\n",availableFrame);
-	dump_memoryframe_info();
-	int i = 0;
-	int id = -1;
-	int pageno = -1;
-	if(memFrame[availableFrame].dirty == dirtyFrame){
-		int addr = (i & pageoffsetMask) | (availableFrame << pagenumShift);
-		update_process_pagetable(memFrame[availableFrame].pid, memFrame[availableFrame].page, diskPage);
-		insert_swapQ(memFrame[availableFrame].pid, memFrame[availableFrame].page, &Memory[addr], actWrite, Nothing);
-		//printf("Page Fault Handler: pid/page=(%d,%d)\n",memFrame[availableFrame].pid,memFrame[availableFrame].page);
-		id = memFrame[availableFrame].pid;
-		pageno = memFrame[availableFrame].page;
+  // without a replaceable frame, pid goes back to the ready queue and its
+  // instruction faults again, till a frame is freed (age scan, exits)
+
+	int faultPage = (pfpage == ginstr) ? CPU.PC/pageSize : CPU.IRoperand/pageSize;
+	int frame;
+	numFaults++;
+	pffFaults[CPU.Pid]++;
+	PCB[CPU.Pid]->numPF += 1 ;
+	frame = get_pte(CPU.Pid, faultPage);
+	if(frame == nullPage){
+		// filled in place: back to the ready queue (execute_process)
+		if(!zero_fill_page(CPU.Pid, faultPage)) CPU.exeStatus = eReady;
+		return;
 	}
-	int addr = (i & pageoffsetMask) | (availableFrame << pagenumShift);
-
-	if(memFrame[availableFrame].pid != nullPid){
-		update_process_pagetable(memFrame[availableFrame].pid, memFrame[availableFrame].page, diskPage);
-		id = memFrame[availableFrame].pid;
-		pageno = memFrame[availableFrame].page;
-	}
-
-	if(pfpage == ginstr){
-		update_frame_info(availableFrame, CPU.Pid, CPU.PC/pageSize);
-		update_process_pagetable(CPU.Pid, CPU.PC/pageSize, availableFrame);
-		PCB[CPU.Pid]->numPF += 1 ;
-		insert_swapQ(CPU.Pid, CPU.PC/pageSize, &Memory[addr], actRead, toReady);
-		printf("Swap_in: in=(%d,%d,%x), out=(%d,%d,%x), m=%x\n",CPU.Pid,CPU.PC/pageSize,&Memory[addr],id,pageno,&Memory[addr],&Memory[0]);
-		printf("Page Fault Handler: pid/page=(%d,%d)\n",CPU.Pid,CPU.PC/pageSize);
-	}else if(pfpage == gdata){
-		update_frame_info(availableFrame, CPU.Pid, CPU.IRoperand/pageSize);
-		update_process_pagetable(CPU.Pid, CPU.IRoperand/pageSize, availableFrame);
-		PCB[CPU.Pid]->numPF += 1 ;
-		insert_swapQ(CPU.Pid, CPU.IRoperand/pageSize, &Memory[addr], actRead, toReady);
-		printf("Swap_in: in=(%d,%d,%x), out=(%d,%d,%x), m=%x\n",CPU.Pid,CPU.IRoperand/pageSize,&Memory[addr],id,pageno,&Memory[addr],&Memory[0]);
-		printf("Page Fault Handler: pid/page=(%d,%d)\n",CPU.Pid,CPU.IRoperand/pageSize);
+	// a page in memory only faults on a write to a shared text frame
+	frame = pte_frame(CPU.Pid, faultPage, frame);
+	if(frame >= 0){
+		if(!copy_on_write(CPU.Pid, faultPage, frame)) CPU.exeStatus = eReady;
+		return;
 	}
+	if(readaheadMax > 0) readahead_window(CPU.Pid, faultPage);
+	if(map_shared_text(CPU.Pid, faultPage, toReady)) sharedFaults++;
+	else if(!readahead_hit(CPU.Pid, faultPage) && !huge_page_fault(CPU.Pid, faultPage)
+	        && !swap_in_page(CPU.Pid, faultPage))
+		CPU.exeStatus = eReady;
+	if(readaheadMax > 0) readahead(CPU.Pid, faultPage);
 }
 
-// scan the memory and update the age field of each frame
+// periodic scan of the memory frames, fold the reference bits first
+// aging then shifts the age of each frame
 void memory_agescan ()
 { 
-	int i;
-	int count = 0;
-	for (i = OSpages; i < numFrames; ++i) {
-		memFrame[i].age = memFrame[i].age >> 1;
-		if (memFrame[i].age == zeroAge && memFrame[i].free != freeFrame) {
-			addto_free_frame(i, pendingPage);
-			count++;
-		}
+	fold_reference_bits();
+	replacePolicy->periodic_scan();
+	if(localReplace) update_frame_quotas();
+	if(lowWatermark > 0) pageout_daemon();
+	if(ksmPages > 0) ksm_scan();
+	if(writebackBatch > 0 && ++wbScans >= writebackScans){
+		writeback_flush();
+		wbScans = 0;
 	}
-
-	if(count > 0 ){
-		printf("Some frames got freed during age scan\n");
-		dump_memoryframe_info();
+	if(wsWindow > 0){
+		update_working_sets();
+		admit_pending_processes();
 	}
 }
 
 
+void dump_memory_stats ()
+{ int total = numAccesses + numFaults;
+
+  printf ("******************** Memory Statistics\n");
+  printf ("Replacement policy: %s\n", replacePolicy->name);
+  printf ("Accesses/faults = %d/%d", numAccesses, numFaults);
+  if (total > 0) printf (", hit ratio = %.2f%%", 100.0*numAccesses/total);
+  printf ("\n");
+  printf ("Faults: major = %d, zero fill = %d, readahead hits = %d",
+          numFaults-zeroFaults-raHits-sharedFaults-cowFaults-frameRetries,
+          zeroFaults, raHits);
+  if (frameRetries > 0) printf (", retried = %d", frameRetries);
+  printf ("\n");
+  if (shareText)
+    printf ("Shared text: mapped = %d (%d on faults), copy on write = %d (%d copies)\n",
+            sharedMaps, sharedFaults, cowFaults, cowCopies);
+  replacePolicy->dump();
+  if (ptMode == radixPT)
+    printf ("Radix page table nodes = %d (%d bytes)\n", ptNodes,
+            ptNodes * (int)(sizeof(PTnode) + ptFanout*sizeof(int *)));
+  if (hugeFactor > 1)
+    printf ("Huge pages of %d pages: faults = %d, demotions = %d\n",
+            hugeFactor, hugeFaults, hugeDemotions);
+  if (faultCluster > 1)
+    printf ("Fault clusters = %d, extra pages = %d\n",
+            clusterFaults, clusterPages);
+  if (wsWindow > 0) dump_working_sets ();
+  if (localReplace) dump_frame_quotas ();
+  if (writebackBatch > 0)
+    printf ("Writeback pages = %d, writes = %d, flushes = %d\n",
+            wbPages, wbWrites, wbFlushes);
+  dump_swap_slots ();
+  dump_uring_stats ();
+  if (zswapSize > 0) dump_zswap_stats ();
+  if (swapDedup) dump_dedup_stats ();
+  if (ksmPages > 0)
+    printf ("Same page merging: passes = %d, merges = %d, frames saved = %d\n",
+            ksmPasses, ksmMerges, ksmSaved);
+  if (lowWatermark > 0)
+    printf ("Page-out daemon runs = %d, freed = %d, cleaned = %d\n",
+            pageoutRuns, pageoutFreed, pageoutCleaned);
+  if (readaheadMax > 0)
+    printf ("Readahead pages = %d, hits = %d, waste = %d\n",
+            raPages, raHits, raWaste);
+  if (ptMode == invertedPT)
+  { printf ("Inverted page table entries = %d/%d", iptEntries, iptSize);
+    if (iptLookups > 0)
+      printf (", probes/lookup = %.2f", (float)iptProbes/iptLookups);
+    printf ("\n");
+  }
+}
+
+
 void initialize_memory_manager ()
 { 
   // initialize memory and add page scan event request
 	initialize_memory();
+	initialize_pagetable_mode();
+	if(ksmPages > 0) initialize_ksm();
+	initialize_tlb();
+	initialize_replace_policy();
 	add_timer (periodAgeScan, osPid, actAgeInterrupt, periodAgeScan);
 }
 
@@ -616,10 +1998,24 @@ void initial_page_loading(int pid, int pagesToLoad){
 	int j = 0;
 
 	dump_process_pagetable(pid);
+	writeback_sync(pid, 0, pagesToLoad-1);
+	if(pid > idlePid){
+		wsSize[pid] = pagesToLoad;
+		frameQuota[pid] = (pagesToLoad > 0)? pagesToLoad : 1;
+		if(shareText) textImage[pid] = process_image(pid);
+	}
 	for (i = 0; i < pagesToLoad; i++) {
+		if(map_shared_text(pid, i, (i == pagesToLoad-1)? toReady : Nothing))
+			continue;
 		//mType *buf = (mType *) malloc (pageSize*sizeof(mType));
-		int availableFrame = get_free_frame();
+		int availableFrame = get_free_frame(pid, i);
+		if(availableFrame == nullIndex){
+			// the rest of the pages are brought in by the faults
+			insert_swapQ (pid, i, NULL, actNone, toReady);
+			break;
+		}
 		printf("Got free frame = %d\n",availableFrame);
+		evict_frame(availableFrame);
 		if(i == pagesToLoad - 1){
 			dump_memoryframe_info();
 			update_frame_info(availableFrame, pid, i);
@@ -631,6 +2027,7 @@ void initial_page_loading(int pid, int pagesToLoad){
 			update_process_pagetable (pid, i, availableFrame);
 			insert_swapQ (pid, i, &Memory[availableFrame*pageSize], actRead, Nothing);
 		}
+		share_text_frame(pid, i, availableFrame);
 		printf("Swap_in: in=(%d,%d,%x), out=(%d,%d,%x), m=%x\n",pid,i,&Memory[availableFrame*pageSize],nullIndex,nullIndex,&Memory[availableFrame*pageSize],&Memory[0]);
 	}
 
@@ -2,10 +2,12 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <string.h>
 #include "simos.h"
 
 
 int currentPid = 2;    // user pid should start from 2, pid=0/1 are OS/idle
+                       // the next pid to try, pids of ended processes are reused
 int numUserProcess = 0; 
 
 
@@ -158,20 +160,31 @@ void dump_endWait_list ()
 //=========================================================================
 
 void init_PCB_ptrarry ()
-{ PCB = (typePCB **) malloc (maxProcess*addrSize); }
-
-int new_PCB ()
 { int pid;
 
-  pid = currentPid;
-  currentPid++;
-  if (pid >= maxProcess)
-  { printf ("Exceeding maximum number of processes: %d\n", pid);
-    return (-1);
+  PCB = (typePCB **) malloc (maxProcess*sizeof(typePCB *));
+  for (pid=0; pid<maxProcess; pid++) PCB[pid] = NULL;
+}
+
+// the pids are given out round robin, a free pid (its process has ended)
+// is reused, the swap slots of its old process are released before
+// (free_process_memory queues the release before the new process loads)
+int new_PCB ()
+{ int pid, i;
+
+  for (i=idlePid+1; i<maxProcess; i++)
+  { pid = currentPid;
+    currentPid++;
+    if (currentPid >= maxProcess) currentPid = idlePid+1;
+    if (PCB[pid] == NULL)
+    { PCB[pid] = (typePCB *) malloc ( sizeof(typePCB) );
+      PCB[pid]->Pid = pid;
+      PCB[pid]->resident = 0;
+      return (pid);
+    }
   }
-  PCB[pid] = (typePCB *) malloc ( sizeof(typePCB) );
-  PCB[pid]->Pid = pid;
-  return (pid);
+  printf ("Exceeding maximum number of processes: %d\n", maxProcess);
+  return (-1);
 }
 
 void free_PCB (int pid)
@@ -194,17 +207,17 @@ void dump_PCB (int pid)
 void dump_PCB_list ()
 { int pid;
 
-  printf ("Dump all PCB: From 0 to %d\n", currentPid);
-  for (pid=idlePid; pid<currentPid; pid++)
+  printf ("Dump all PCB: From 0 to %d\n", maxProcess-1);
+  for (pid=idlePid; pid<maxProcess; pid++)
     if (PCB[pid] != NULL) dump_PCB (pid);
 }
 
 void dump_PCB_memory ()
 { int pid;
 
-  printf ("Dump memory/swap of all processes: From 1 to %d\n", currentPid-1);
+  printf ("Dump memory/swap of all processes: From 1 to %d\n", maxProcess-1);
   //dump_process_memory (idlePid);
-  for (pid=idlePid+1; pid<currentPid; pid++)
+  for (pid=idlePid+1; pid<maxProcess; pid++)
     if (PCB[pid] != NULL) dump_process_memory (pid);
 }
 
@@ -254,6 +267,7 @@ void end_process (int pid)
   clean_process (pid); 
     // cpu will clean up process pid without waiting for printing to finish
     // so, io should not access PCB[pid] for end process printing
+  if (wsWindow > 0) admit_pending_processes ();
 }
 
 void init_idle_process ()
@@ -281,34 +295,8 @@ void initialize_process_manager ()
   sem_init (&pmutex, 0, 1);
 }
 
-// submit_process always working on a new pid and the new pid will not be 
-// used by anyone else till submit_process finishes working on it
-// currentPid is not used by anyone else but the dump functions
-// So, no conflict for PCB and Pid related data
-// -----------------
-// During insert_ready_process, there is potential of conflict accesses
-
-int submit_process (char *fname)
-{ int pid, ret, i;
-
-  if ( ((numFrames-OSpages)/(numUserProcess+1)) < 2 )
-    printf ("\aToo many processes => they may not execute due to page faults\n");
-  else
-  { pid = new_PCB ();
-    if (pid > idlePid)
-    { ret = load_process (pid, fname);   // return #pages loaded
-      if (ret > 0)
-      { PCB[pid]->PC = 0;
-        PCB[pid]->AC = 0;
-        PCB[pid]->exeStatus = eReady;
-        PCB[pid]->numPF = ret;
-        PCB[pid]->timeUsed = 0;
-        // swap manager will put the process to ready queue
-        numUserProcess++;
-        return (pid);
-      }
-      else free_PCB (pid);   // cannot clean_process(), no page table
-  } }
+int load_problem (int pid, char *fname)
+{
   // abnormal situation, PCB has not been allocated or has been freed
   char *str = (char *) malloc (80);
   printf ("Program %s has loading problem!!!\n", fname);
@@ -317,6 +305,109 @@ int submit_process (char *fname)
   return (-1);
 }
 
+// create_process always working on a free pid and the pid will not be 
+// used by anyone else till create_process finishes working on it
+// currentPid is not used by anyone else but new_PCB
+// So, no conflict for PCB and Pid related data
+// -----------------
+// During insert_ready_process, there is potential of conflict accesses
+
+int create_process (char *fname)
+{ int pid, ret;
+
+  pid = new_PCB ();
+  if (pid > idlePid)
+  { ret = load_process (pid, fname);   // return #pages loaded
+    if (ret > 0)
+    { PCB[pid]->PC = 0;
+      PCB[pid]->AC = 0;
+      PCB[pid]->exeStatus = ePFault;   // eReady once its pages are loaded
+      PCB[pid]->numPF = ret;
+      PCB[pid]->timeUsed = 0;
+      PCB[pid]->lastFaultPage = nullPage;
+      PCB[pid]->raWindow = 0;
+      // swap manager will put the process to ready queue
+      numUserProcess++;
+      return (pid);
+    }
+    else free_PCB (pid);   // cannot clean_process(), no page table
+  }
+  return (load_problem (pid, fname));
+}
+
+//=========================================================================
+// admission control
+// wsWindow = 0: a program is rejected if each process would get < 2 frames
+// wsWindow > 0: a program is admitted only if the working sets of the
+//   processes in the system plus loadPpages for the new one fit in the
+//   user frames, otherwise it waits in the pending queue (FIFO), which is
+//   checked again after each age scan and when a process ends
+//=========================================================================
+
+typedef struct PendingNodeStruct
+{ char *fname;
+  struct PendingNodeStruct *next;
+} PendingNode;
+
+PendingNode *pendingHead = NULL;
+PendingNode *pendingTail = NULL;
+
+int working_set_admission ()
+{
+  // a process is always admitted into an empty system
+  return (numUserProcess == 0 ||
+          total_working_set () + loadPpages <= numFrames-OSpages);
+}
+
+void insert_pending_process (char *fname)
+{ PendingNode *node;
+
+  node = (PendingNode *) malloc (sizeof (PendingNode));
+  node->fname = (char *) malloc (strlen (fname) + 1);
+  strcpy (node->fname, fname);
+  node->next = NULL;
+  if (pendingTail == NULL) { pendingTail = node; pendingHead = node; }
+  else { pendingTail->next = node; pendingTail = node; }
+  printf ("Program %s is pending, working sets exceed the memory\n", fname);
+}
+
+void admit_pending_processes ()
+{ PendingNode *node;
+
+  while (pendingHead != NULL && working_set_admission ())
+  { node = pendingHead;
+    pendingHead = node->next;
+    if (pendingHead == NULL) pendingTail = NULL;
+    printf ("Program %s is admitted from the pending queue\n", node->fname);
+    create_process (node->fname);
+    free (node->fname); free (node);
+  }
+}
+
+void dump_pending_queue ()
+{ PendingNode *node;
+
+  printf ("Pending Queue = ");
+  node = pendingHead;
+  while (node != NULL) { printf ("%s, ", node->fname); node = node->next; }
+  printf ("\n");
+}
+
+int submit_process (char *fname)
+{
+  if (wsWindow > 0)
+  { if (pendingHead == NULL && working_set_admission ())
+      return (create_process (fname));
+    insert_pending_process (fname);
+    return (0);
+  }
+  if ( ((numFrames-OSpages)/(numUserProcess+1)) < 2 )
+  { printf ("\aToo many processes => they may not execute due to page faults\n");
+    return (load_problem (nullPid, fname));
+  }
+  return (create_process (fname));
+}
+
 
 void execute_process ()
 { int pid, intime;
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "simos.h"
+
+
+//======================================================================
+// This module implements the page replacement policies.
+// paging.c calls the functions of the policy in use (replacePolicy)
+// when a frame is accessed, gets a new page, is freed or cleaned,
+// when a victim is needed, and on each age scan interrupt.
+// config.sys input: replaceMode, wsclockWindow
+// ------------------------------------------------
+// aging: age vector shifted by the age scan, evict the lowest age
+// clock: second chance on the reference bit
+// wsclock: clock on the reference bit and the working set window
+// arc: adaptive replacement cache, recency and frequency lists with ghosts
+//======================================================================
+
+
+//==========================================
+// frame lists used by the policies
+// a frame is on at most one list, memFrame.plist[] tells which list
+// head is the most recently inserted frame (MRU), tail is the LRU
+//==========================================
+
+typedef struct
+{ int head, tail, size;
+} FrameList;
+
+void flist_init (FrameList *lists, int num)
+{ int i;
+
+  for (i=0; i<num; i++)
+  { lists[i].head = nullIndex; lists[i].tail = nullIndex; lists[i].size = 0; }
+}
+
+void flist_push (FrameList *lists, int listid, int findex)
+{ FrameList *list = &lists[listid];
+
+  memFrame.plist[findex] = listid;
+  memFrame.pprev[findex] = nullIndex;
+  memFrame.pnext[findex] = list->head;
+  if (list->head != nullIndex) memFrame.pprev[list->head] = findex;
+  else list->tail = findex;
+  list->head = findex;
+  list->size++;
+}
+
+void flist_remove (FrameList *lists, int findex)
+{ FrameList *list;
+  int next, prev;
+
+  if (memFrame.plist[findex] == nullIndex) return;
+  list = &lists[memFrame.plist[findex]];
+  next = memFrame.pnext[findex];
+  prev = memFrame.pprev[findex];
+  if (prev != nullIndex) memFrame.pnext[prev] = next;
+  else list->head = next;
+  if (next != nullIndex) memFrame.pprev[next] = prev;
+  else list->tail = prev;
+  list->size--;
+  memFrame.plist[findex] = nullIndex;
+}
+
+// frames that can be replaced: used by a process and not pinned
+int replaceable_frame (int findex)
+{ return (memFrame.free[findex] == usedFrame
+          && memFrame.pinned[findex] == nopinFrame
+          && memFrame.pid[findex] != nullPid);
+}
+
+void no_frame_op (int findex) { }
+void no_scan_op () { }
+
+
+//==========================================
+// aging policy
+// age is set to highestAge on access and shifted right by each age scan
+// frames whose age drops to zero are put to the free list by the scan
+// ------------------------------------------------
+// used frames are kept in age bucketed lists for victim selection
+// age is either zero or a power of 2, so one level holds exactly one age
+// level 0 is age zero, level numAgeLevels-1 is highestAge
+// each level has a clean list and a dirty list, the lists of level l are
+// in slot (ageBase+l) % numAgeLevels, list = slot*2 + dirty
+// the age scan shifts all ages by advancing ageBase, frames stay in their
+// lists, and the old level 0 slot (empty) becomes the highestAge slot
+// victim is the first frame of the lowest nonempty list, in constant time
+// the age shift itself is done by the age vector kernel (agescan.c)
+//==========================================
+
+#define numAgeLevels 9
+FrameList ageBucket[numAgeLevels*2];
+int ageBase;   // slot of level 0
+
+int age_level (ageType age)
+{ int level = 0;
+
+  while (age != zeroAge) { age = age >> 1; level++; }
+  if (level >= numAgeLevels) level = numAgeLevels - 1;
+  return (level);
+}
+
+int age_slot (int level)
+{ return ((ageBase + level) % numAgeLevels); }
+
+int age_list (int findex)
+{ return (age_slot (age_level (memFrame.age[findex]))*2
+          + memFrame.dirty[findex]);
+}
+
+void aging_init ()
+{ flist_init (ageBucket, numAgeLevels*2);
+  ageBase = 0;
+  initialize_age_kernel ();
+  printf ("Age scan kernel: %s\n", ageKernel->name);
+}
+
+// move the frame to the list matching its age and dirty fields
+// frames that are not in a bucket (free or pinned) are left alone
+void aging_relist (int findex)
+{ int list;
+
+  if (memFrame.plist[findex] == nullIndex) return;
+  list = age_list (findex);
+  if (list == memFrame.plist[findex]) return;
+  flist_remove (ageBucket, findex);
+  flist_push (ageBucket, list, findex);
+}
+
+void aging_on_access (int findex, int rwflag)
+{ memFrame.age[findex] = highestAge;
+  aging_relist (findex);
+}
+
+void aging_on_fault (int findex)
+{ flist_push (ageBucket, age_list (findex), findex); }
+
+void aging_on_free (int findex)
+{ flist_remove (ageBucket, findex); }
+
+// select a frame with the lowest age
+// if there are multiple frames with the same lowest age, then choose the one
+// that is not dirty, the other clean frames of that age are put to the
+// free list for later faults
+int aging_select_victim (int pid, int page)
+{ int level, list, j, next;
+  int victim = nullIndex;
+  ageType lowest;
+
+  // free list is empty, so all user frames are candidates
+  // check the buckets against a full search of the age array
+  if (memDebug)
+    lowest = memFrame.age[OSpages + ageKernel->min_index
+                            (&memFrame.age[OSpages], numFrames-OSpages)];
+  for (level = 0; level < numAgeLevels && victim == nullIndex; level++)
+  { list = age_slot (level)*2;
+    if (ageBucket[list+cleanFrame].head != nullIndex)
+    { victim = ageBucket[list+cleanFrame].head;
+      j = memFrame.pnext[victim];
+      while (j != nullIndex)
+      { next = memFrame.pnext[j];
+        addto_free_frame (j, pendingPage);
+        j = next;
+      }
+    }
+    else victim = ageBucket[list+dirtyFrame].head;
+  }
+  if (victim == nullIndex) return (nullIndex);   // no frame replaceable
+  if (memDebug && memFrame.age[victim] != lowest)
+    printf ("Error: age bucket victim %d has age %x, lowest age is %x\n",
+            victim, memFrame.age[victim], lowest);
+  printf ("Selected agest frame = %d, age = %x, dirty = %d\n",
+          victim, memFrame.age[victim], memFrame.dirty[victim]);
+  return (victim);
+}
+
+// scan the memory and update the age field of each frame
+// all ages are shifted by 1, so each bucket moves down one level
+// frames then in level 0 have age zero and are freed
+void aging_periodic_scan ()
+{ int list;
+  int count = 0;
+
+  ageKernel->shift (&memFrame.age[OSpages], numFrames-OSpages);
+  ageBase = (ageBase + 1) % numAgeLevels;
+  for (list = ageBase*2; list <= ageBase*2 + 1; list++)
+    while (ageBucket[list].head != nullIndex)
+    { addto_free_frame (ageBucket[list].head, pendingPage);
+      count++;
+    }
+
+  if (count > 0)
+  { printf ("Some frames got freed during age scan\n");
+    dump_memoryframe_info ();
+  }
+}
+
+void aging_dump ()
+{ int level, list;
+
+  printf ("Age buckets (age: #clean/#dirty):");
+  for (level = numAgeLevels-1; level >= 0; level--)
+  { list = age_slot (level)*2;
+    printf (" %x:%d/%d", (highestAge << 1) >> (numAgeLevels-level),
+            ageBucket[list+cleanFrame].size, ageBucket[list+dirtyFrame].size);
+  }
+  printf ("\n");
+}
+
+
+//==========================================
+// clock (second chance) policy
+// the hand sweeps the frames, a referenced frame gets its bit cleared
+// and a second chance, the first unreferenced frame is the victim
+//==========================================
+
+int clockHand;
+
+void clock_init ()
+{ clockHand = OSpages; }
+
+void clock_advance ()
+{ clockHand++;
+  if (clockHand >= numFrames) clockHand = OSpages;
+}
+
+void clock_on_access (int findex, int rwflag)
+{ memFrame.referenced[findex] = 1; }
+
+void clock_on_fault (int findex)
+{ memFrame.referenced[findex] = 1; }
+
+// at most two rounds: the first round clears all reference bits
+int clock_select_victim (int pid, int page)
+{ int i, victim = nullIndex;
+
+  for (i = 0; i < 2*(numFrames-OSpages) && victim == nullIndex; i++)
+  { if (replaceable_frame (clockHand))
+    { if (memFrame.referenced[clockHand]) memFrame.referenced[clockHand] = 0;
+      else victim = clockHand;
+    }
+    clock_advance ();
+  }
+  if (victim != nullIndex)
+    printf ("Selected clock frame = %d, dirty = %d\n",
+            victim, memFrame.dirty[victim]);
+  return (victim);
+}
+
+void clock_dump ()
+{ printf ("Clock hand = %d\n", clockHand); }
+
+
+//==========================================
+// wsclock policy
+// like clock, but an unreferenced frame is only replaced when it is out of
+// the working set (not used in the last wsclockWindow cycles)
+// the last use time is the time the reference bit was seen
+// dirty frames out of the working set are written back, not replaced,
+// they become candidates when the hand comes back
+// if no frame is out of the working set, the least recently used
+// unreferenced frame is replaced
+//==========================================
+
+int wsclockCleaned;   // #frames scheduled for write back by wsclock
+
+void wsclock_init ()
+{ clockHand = OSpages; wsclockCleaned = 0; }
+
+void wsclock_on_access (int findex, int rwflag)
+{ memFrame.referenced[findex] = 1;
+  memFrame.lastUse[findex] = CPU.numCycles;
+}
+
+void wsclock_on_fault (int findex)
+{ memFrame.referenced[findex] = 1;
+  memFrame.lastUse[findex] = CPU.numCycles;
+}
+
+int wsclock_select_victim (int pid, int page)
+{ int i, victim = nullIndex;
+  int oldest = nullIndex;
+
+  for (i = 0; i < 2*(numFrames-OSpages) && victim == nullIndex; i++)
+  { if (replaceable_frame (clockHand))
+    { if (memFrame.referenced[clockHand])
+      { memFrame.referenced[clockHand] = 0;
+        memFrame.lastUse[clockHand] = CPU.numCycles;
+      }
+      else if (CPU.numCycles - memFrame.lastUse[clockHand] > wsclockWindow)
+      { if (memFrame.dirty[clockHand] == cleanFrame) victim = clockHand;
+        else { clean_frame (clockHand); wsclockCleaned++; }
+      }
+      else if (oldest == nullIndex
+               || memFrame.lastUse[clockHand] < memFrame.lastUse[oldest])
+        oldest = clockHand;
+    }
+    if (victim == nullIndex) clock_advance ();
+  }
+  if (victim == nullIndex) victim = oldest;   // nullIndex if none replaceable
+  clock_advance ();
+  if (victim != nullIndex)
+    printf ("Selected wsclock frame = %d, last use = %d, dirty = %d\n",
+            victim, memFrame.lastUse[victim], memFrame.dirty[victim]);
+  return (victim);
+}
+
+void wsclock_dump ()
+{ printf ("Clock hand = %d, window = %d, cleaned = %d\n",
+          clockHand, wsclockWindow, wsclockCleaned);
+}
+
+
+//==========================================
+// ARC (adaptive replacement cache) policy
+// T1: frames referenced once, T2: frames referenced more than once
+// B1, B2: ghost lists, the (pid,page) of frames recently evicted from T1, T2
+// a fault on a B1 ghost grows the target size p of T1, on a B2 ghost
+// shrinks it; the victim comes from T1 if it exceeds p, else from T2
+// c = #user frames, |T1|+|B1| <= c, |T1|+|T2|+|B1|+|B2| <= 2c
+// the access retried after the fault is not a second reference, a frame
+// is fresh until then (arcFresh), only a later reference moves it to T2
+//==========================================
+
+#define arcT1 0
+#define arcT2 1
+#define arcB1 0
+#define arcB2 1
+
+FrameList arcList[2];   // T1 and T2, lists of frames
+
+typedef struct
+{ int pid, page, list;
+  int next, prev;   // links in B1 or B2, head is MRU
+  int hnext;        // link in the hash chain
+} ArcGhost;
+
+ArcGhost *arcGhost;   // arcGhost[2c], the ghost entries
+int *arcHash;         // arcHash[c], heads of the hash chains
+int arcGhostHead[2], arcGhostTail[2], arcGhostSize[2];
+int arcFreeGhost;     // list of unused ghost entries, linked by next
+int arcC, arcP;
+char *arcFresh;       // arcFresh[frame], 1 till the first access after a fault
+
+#define arc_hash(pid,page) (((unsigned)(page) + (pid) * 31) % arcC)
+
+void arc_init ()
+{ int i;
+
+  arcC = numFrames - OSpages;
+  arcP = 0;
+  flist_init (arcList, 2);
+  arcFresh = (char *) calloc (numFrames, 1);
+  arcGhost = (ArcGhost *) malloc (2*arcC*sizeof(ArcGhost));
+  arcHash = (int *) malloc (arcC*sizeof(int));
+  for (i=0; i<arcC; i++) arcHash[i] = nullIndex;
+  for (i=0; i<2*arcC; i++) arcGhost[i].next = i+1;
+  arcGhost[2*arcC-1].next = nullIndex;
+  arcFreeGhost = 0;
+  for (i=0; i<2; i++)
+  { arcGhostHead[i] = nullIndex; arcGhostTail[i] = nullIndex;
+    arcGhostSize[i] = 0;
+  }
+}
+
+int arc_find_ghost (int pid, int page)
+{ int g;
+
+  g = arcHash[arc_hash(pid,page)];
+  while (g != nullIndex
+         && (arcGhost[g].pid != pid || arcGhost[g].page != page))
+    g = arcGhost[g].hnext;
+  return (g);
+}
+
+void arc_remove_ghost (int g)
+{ int list, h, *link;
+
+  list = arcGhost[g].list;
+  if (arcGhost[g].prev != nullIndex)
+    arcGhost[arcGhost[g].prev].next = arcGhost[g].next;
+  else arcGhostHead[list] = arcGhost[g].next;
+  if (arcGhost[g].next != nullIndex)
+    arcGhost[arcGhost[g].next].prev = arcGhost[g].prev;
+  else arcGhostTail[list] = arcGhost[g].prev;
+  arcGhostSize[list]--;
+
+  h = arc_hash(arcGhost[g].pid, arcGhost[g].page);
+  link = &arcHash[h];
+  while (*link != g) link = &arcGhost[*link].hnext;
+  *link = arcGhost[g].hnext;
+
+  arcGhost[g].next = arcFreeGhost;
+  arcFreeGhost = g;
+}
+
+void arc_add_ghost (int pid, int page, int list)
+{ int g, h;
+
+  if (arcFreeGhost == nullIndex)   // full, drop the LRU of the longer list
+    arc_remove_ghost (arcGhostTail[arcGhostSize[arcB1] > arcGhostSize[arcB2]
+                                   ? arcB1 : arcB2]);
+  g = arcFreeGhost;
+  arcFreeGhost = arcGhost[g].next;
+  arcGhost[g].pid = pid;
+  arcGhost[g].page = page;
+  arcGhost[g].list = list;
+  arcGhost[g].prev = nullIndex;
+  arcGhost[g].next = arcGhostHead[list];
+  if (arcGhostHead[list] != nullIndex) arcGhost[arcGhostHead[list]].prev = g;
+  else arcGhostTail[list] = g;
+  arcGhostHead[list] = g;
+  arcGhostSize[list]++;
+  h = arc_hash(pid, page);
+  arcGhost[g].hnext = arcHash[h];
+  arcHash[h] = g;
+}
+
+void arc_on_access (int findex, int rwflag)
+{ if (memFrame.plist[findex] == nullIndex) return;
+  if (arcFresh[findex]) { arcFresh[findex] = 0; return; }
+  flist_remove (arcList, findex);
+  flist_push (arcList, arcT2, findex);
+}
+
+void arc_on_fault (int findex)
+{ int g, delta;
+
+  g = arc_find_ghost (memFrame.pid[findex], memFrame.page[findex]);
+  if (g != nullIndex && arcGhost[g].list == arcB1)
+  { delta = arcGhostSize[arcB2] / arcGhostSize[arcB1];
+    if (delta < 1) delta = 1;
+    arcP = (arcP + delta > arcC) ? arcC : arcP + delta;
+  }
+  else if (g != nullIndex)
+  { delta = arcGhostSize[arcB1] / arcGhostSize[arcB2];
+    if (delta < 1) delta = 1;
+    arcP = (arcP - delta < 0) ? 0 : arcP - delta;
+  }
+  if (g != nullIndex)
+  { arc_remove_ghost (g);
+    flist_push (arcList, arcT2, findex);
+  }
+  else flist_push (arcList, arcT1, findex);
+  arcFresh[findex] = 1;
+
+  // keep the directory within its bounds
+  while (arcList[arcT1].size + arcGhostSize[arcB1] > arcC
+         && arcGhostSize[arcB1] > 0)
+    arc_remove_ghost (arcGhostTail[arcB1]);
+  while (arcList[arcT1].size + arcList[arcT2].size
+         + arcGhostSize[arcB1] + arcGhostSize[arcB2] > 2*arcC
+         && arcGhostSize[arcB2] > 0)
+    arc_remove_ghost (arcGhostTail[arcB2]);
+}
+
+void arc_on_free (int findex)
+{ flist_remove (arcList, findex); arcFresh[findex] = 0; }
+
+int arc_select_victim (int pid, int page)
+{ int g, victim, inB2;
+
+  g = arc_find_ghost (pid, page);
+  inB2 = (g != nullIndex && arcGhost[g].list == arcB2);
+  if (arcList[arcT1].size == 0 && arcList[arcT2].size == 0)
+    return (nullIndex);   // no frame replaceable
+  if (arcList[arcT1].size > 0
+      && (arcList[arcT1].size > arcP
+          || (inB2 && arcList[arcT1].size == arcP)
+          || arcList[arcT2].size == 0))
+  { victim = arcList[arcT1].tail;
+    arc_add_ghost (memFrame.pid[victim], memFrame.page[victim], arcB1);
+  }
+  else
+  { victim = arcList[arcT2].tail;
+    arc_add_ghost (memFrame.pid[victim], memFrame.page[victim], arcB2);
+  }
+  flist_remove (arcList, victim);
+  printf ("Selected arc frame = %d, p = %d, dirty = %d\n",
+          victim, arcP, memFrame.dirty[victim]);
+  return (victim);
+}
+
+void arc_dump ()
+{ printf ("ARC c/p = %d/%d, |T1|/|T2| = %d/%d, |B1|/|B2| = %d/%d\n",
+          arcC, arcP, arcList[arcT1].size, arcList[arcT2].size,
+          arcGhostSize[arcB1], arcGhostSize[arcB2]);
+}
+
+
+//==========================================
+// policy table, indexed by replaceMode
+//==========================================
+
+ReplacePolicy replacePolicies[] =
+{ { "aging", aging_init, aging_on_access, aging_on_fault, aging_on_free,
+    aging_relist, aging_select_victim, aging_periodic_scan, aging_dump },
+  { "clock", clock_init, clock_on_access, clock_on_fault, no_frame_op,
+    no_frame_op, clock_select_victim, no_scan_op, clock_dump },
+  { "wsclock", wsclock_init, wsclock_on_access, wsclock_on_fault, no_frame_op,
+    no_frame_op, wsclock_select_victim, no_scan_op, wsclock_dump },
+  { "arc", arc_init, arc_on_access, arc_on_fault, arc_on_free,
+    no_frame_op, arc_select_victim, no_scan_op, arc_dump }
+};
+
+#define numPolicies ((int) (sizeof(replacePolicies)/sizeof(ReplacePolicy)))
+
+void initialize_replace_policy ()
+{
+  if (replaceMode < 0 || replaceMode >= numPolicies)
+  { printf ("Incorrect replacement policy %d, use aging\n", replaceMode);
+    replaceMode = agingPolicy;
+  }
+  replacePolicy = &replacePolicies[replaceMode];
+  replacePolicy->init ();
+  printf ("Page replacement policy: %s\n", replacePolicy->name);
+}
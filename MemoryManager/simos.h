@@ -33,9 +33,34 @@ int periodAgeScan; // the period for scanning and shifting the age vectors
                    // defined in # instruction-cycles
 int termPrintTime;   // simulated time (sleep) for terminal to output a string
 int diskRWtime;   // simulated time (sleep) for disk IO (a page)
+int tlbSize;   // #entries in the software TLB, 0 disables the TLB
+int replaceMode;   // page replacement policy, see replace.c definitions
+int wsclockWindow;   // working set window of wsclock, in instruction-cycles
+int ptMode;   // process page table organization, see paging.c definitions
+int ptFanout;   // #entries in each radix page table node
+int hugeFactor;   // #pages in a huge page (power of 2), 1 disables huge pages
+int readaheadMax;   // max readahead window in pages, 0 disables readahead
+int faultCluster;   // max #pages swapped in by one fault, 1 disables clustering
+int wsWindow;   // working set window in cycles, 0: simple admission check
+int localReplace;   // 1: page fault frequency based per process frame quota
+int pffLow, pffHigh;   // #faults per age scan period to shrink/grow a quota
+int lowWatermark, highWatermark;   // free frames for the page-out daemon
+int writebackBatch;   // #dirty pages buffered before a flush, 0: write through
+int writebackScans;   // flush the buffered pages every writebackScans age scans
+int shareText;   // 1: processes of the same program share their text pages
+int zswapSize;   // bytes of the compressed swap cache, 0 disables it
+int ksmPages;   // #frames the same page merging scanner checks per age scan
+int swapDedup;   // 1: content addressed swap store, identical pages share
+int swapWorkers;   // #threads processing the swap queue
+int swapUring;   // 1: io_uring swap IO by one thread, else swapWorkers
+int swapSched;   // swap IO scheduler: 0: fifo, 1: C-LOOK, 2: deadline
+int readExpire, writeExpire;   // deadline: #dispatches a read/write waits
+int swapReadPrio;   // #fault reads going ahead of the older requests, 0: off
 
 //=============== paging.c related definitions ====================
 
+#include "agescan.h"   // ageType and the age vector kernels
+
 // memory data type defintion, could be int or float
 //typedef int mdType; 
 //#define mdInFormat "%d"
@@ -75,6 +100,7 @@ void dump_process_memory (int pid);
 void dump_memory ();
 void dump_free_list ();
 void dump_memoryframe_info ();
+void dump_tlb ();
 
   // interrupt handling functions, called by cpu.c
 void page_fault_handler ();
@@ -83,6 +109,102 @@ void memory_agescan ();
 void initialize_memory_manager ();   // called by system.c
 
 void initial_page_loading(int pid, int pagesToLoad);
+void dump_memory_stats ();
+
+// memory frame metadata, shared by paging.c and replace.c
+// other modules should not access the frame fields directly
+
+// the frame table is a structure of arrays, each field is a contiguous
+// array of numFrames entries, e.g., memFrame.age[findex]
+// so the age scan only walks the age array (see agescan.c)
+
+typedef struct
+{ int *pid, *page;   // the frame is allocated to process pid for page page
+  ageType *age;
+  char *free, *dirty, *pinned;   // in real systems, these are bits
+  char *referenced;   // reference bit, for clock based policies
+  int *lastUse;   // cycle of the last reference, for wsclock
+  int *next, *prev;   // links in the free frame list
+  int *plist;   // replacement policy list of the frame, nullIndex if none
+  int *pnext, *pprev;   // links in the replacement policy list
+  char *huge;   // frame is part of a huge page (hugeFactor aligned frames)
+  char *ahead;   // frame has been read ahead, its page has not faulted yet
+  int *refCount;   // #page tables mapping a shared frame, 0 if private
+  char *merged;   // shared frame made by same page merging, not program text
+} FrameTable;
+
+FrameTable memFrame;
+
+// define special values for page/frame number
+#define nullIndex -1   // free frame list null pointer
+#define nullPage -1   // page does not exist yet
+#define diskPage -2   // page is on disk swap space
+#define pendingPage -3  // page is pending till it is actually swapped
+#define hugeTail -4   // page is in a huge page, the first page maps it
+#define hugePTE 0x40000000   // set with the frame number of a huge page
+#define aheadPTE 0x20000000   // set with the frame of a page being read ahead
+   // have to ensure: #memory-frames < address-space/2, (pageSize >= 2)
+   //    becuase we use negative values with the frame number
+   // nullPage & diskPage are used in process page table 
+
+// define values for the per-frame arrays of memFrame (FrameTable)
+#define zeroAge 0x00000000
+#define highestAge 0x80
+#define dirtyFrame 1
+#define cleanFrame 0
+#define freeFrame 1
+#define usedFrame 0
+#define pinnedFrame 1
+#define nopinFrame 0
+
+// define values of ptMode
+#define flatPT 0    // one array of maxPpages entries per process
+#define radixPT 1   // multi-level tree, nodes allocated on demand
+#define invertedPT 2   // global hash of resident pages + per process swap bitmap
+
+// define rwflag to indicate whehter the addr computation is for read or write
+#define flagRead 1
+#define flagWrite 2
+
+int total_working_set ();   // called by process.c for admission control
+void addto_free_frame (int findex, int status);
+void clean_frame (int findex);
+     // called by replace.c to free frames or write dirty frames back
+
+//=============== replace.c related definitions ====================
+
+// page replacement policy, selected by replaceMode in config.sys
+// paging.c calls the policy functions, the policy keeps its own state
+// on_access: frame has been read or written (rwflag), dirty is already set
+//            the access path only sets the reference bits, on_access is
+//            called when the bits are folded (age scan, victim selection)
+// on_fault: frame has just been given a new page (pid/page are set)
+// on_free: frame is leaving its page (freed or going to be reused)
+// on_clean: dirty frame has been written back and is clean again
+// select_victim: pick a used frame to replace for the faulting pid/page
+//                nullIndex if no frame can be replaced (all pinned or free)
+// periodic_scan: called on each age scan interrupt
+
+typedef struct
+{ char *name;
+  void (*init) ();
+  void (*on_access) (int findex, int rwflag);
+  void (*on_fault) (int findex);
+  void (*on_free) (int findex);
+  void (*on_clean) (int findex);
+  int (*select_victim) (int pid, int page);
+  void (*periodic_scan) ();
+  void (*dump) ();
+} ReplacePolicy;
+
+#define agingPolicy 0     // values of replaceMode
+#define clockPolicy 1
+#define wsclockPolicy 2
+#define arcPolicy 3
+
+ReplacePolicy *replacePolicy;   // the policy in use
+
+void initialize_replace_policy ();   // called by paging.c
 
 //================= cpu.c related definitions ======================
 
@@ -142,6 +264,9 @@ typedef struct
   int exeStatus;
   int timeUsed;
   int numPF;
+  int lastFaultPage;   // for sequential readahead, see paging.c
+  int raWindow;
+  int resident;   // #frames owned, for local replacement, see paging.c
 } typePCB;
 
 typePCB **PCB;
@@ -161,6 +286,9 @@ typePCB **PCB;
 void dump_PCB (int pid); 
 void dump_ready_queue ();
 
+void admit_pending_processes ();   // called by paging.c after the age scan
+void dump_pending_queue ();
+
 void insert_endWait_process (int pid); 
      // called by clock.c (sleep), term.c (output), memory.c (page fault)
      // need semaphore protection for the endWait queue access
@@ -182,15 +310,55 @@ void execute_process ();  // called by admin.c
 #define Both    6   // 6: both 2 and 4 (not used)
 #define actRead 0   // flags for act (action), read or write, with(out) signal
 #define actWrite 1
+#define actNone 2   // no disk IO, only finishact, after the earlier requests
+#define actDrop 3   // no disk IO, release the swap pages of pid when it ends
+#define actCopy 4   // no disk IO, copy a page to buf, or zero it (see below)
 
 void insert_swapQ (int pid, int page, unsigned *buf, int act, int finishact);
+void insert_swapQ_pages (int pid, int page, int npages, unsigned *buf,
+                         int act, int finishact);
+void insert_swapQ_cluster (int pid, int page, int npages, unsigned **bufv,
+                           int act, int finishact);
+int insert_swapQ_copy (int pid, int page, unsigned *buf, unsigned *src,
+                       int finishact);   // 0: done in place, no finishact
 void dump_swapQ ();
+int swap_page_slot (int pid, int page);   // swap file slot, nullIndex if none
+void dump_swap_slots ();   // called by paging.c with the memory statistics
+void dump_uring_stats ();   // called by paging.c with the memory statistics
 int dump_process_swap_page (int pid, int page);
 void dump_process_swap (int pid);
 void dump_swap ();
 void start_swap_manager ();
 void end_swap_manager ();
 
+// compressed swap cache, zswap.c, used by swap.c
+int read_swap_page (int pid, int page, int npages, unsigned *buf);
+int write_swap_page (int pid, int page, int npages, unsigned *buf);
+int swap_cluster_io (int pid, int page, int npages, unsigned **bufv, int act);
+void zswap_store (int pid, int page, unsigned *buf);
+void zswap_read (int pid, int page, int npages, unsigned **bufv);
+int zswap_peek (int pid, int page, unsigned *buf);
+void zswap_drop (int pid);
+void dump_zswap_stats ();   // called by paging.c with the memory statistics
+void initialize_zswap ();
+
+// content addressed swap store, dedup.c, used by swap.c
+int alloc_swap_slot (int hint);
+void free_swap_slot (int slot);
+void read_swap_slot (int slot, unsigned *buf);
+void write_swap_slot (int slot, unsigned *buf);
+void dedup_write (int pid, int page, unsigned *buf);
+void dedup_read (int pid, int page, unsigned *buf, int count);
+void dedup_drop (int pid);
+void dump_dedup_stats ();   // called by paging.c with the memory statistics
+void initialize_dedup ();
+
+// io_uring for the swap disk, uring.c, used by swap.c
+int uring_init (int entries);
+void uring_prep (int act, int fd, void *iov, int n, long off, void *data);
+int uring_submit (int wait);
+void *uring_reap (int *res);
+
 //=============== clock.c related definitions ====================
 
 #define oneTimeTimer 0
@@ -238,6 +406,8 @@ void end_client_submission ();
 void one_submission ();
 int load_process (int pid, char *fname);
 void load_idle_process ();
+int process_image (int pid);   // program image of pid, for shared text
+int image_text_pages (int image);   // #pages with instructions
 
 // return status of loader, whether the program being loaded is correct
 #define progError -1
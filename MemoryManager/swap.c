@@ -2,7 +2,11 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include <semaphore.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "simos.h"
 
 
@@ -18,70 +22,235 @@
 #define swapFname "swap.disk"
 #define itemPerLine 8
 int diskfd;
-int swapspaceSize;
-int PswapSize;
 int pagedataSize;
 
 sem_t swap_semaq;
 sem_t swapq_mutex;
-sem_t disk_mutex;
+sem_t slot_mutex;   // the slot table, the disk IO itself is not serialized
 
 //===================================================
 // This is the simulated disk, including disk read, write, dump.
 // The unit is a page
 //===================================================
-// each process has a fix-sized swap space, its page count starts from 0
+// the swap file is an array of page slots, a page of a process gets a slot
+// when it is first written and keeps it till the process ends (actDrop),
+// the slot is then reused by later processes, so pids can be reused and
+// the file only grows to the highest slot ever in use.
+// A page that has never been written has no slot, it is read as zeros.
+// Pages in consecutive slots (e.g., a huge page, a program image loaded by
+// loader.c) are transferred in one IO
+// The IO uses positional reads/writes (pread/pwrite), there is no shared
+// file position, so the swap workers do their IO at the same time
 // first 2 processes: OS=0, idle=1, have no swap space
 // OS frequently (like Linux) runs on physical memory address (fixed locations)
 // virtual memory is too expensive and unnecessary for OS => no swap needed
 
-int read_swap_page (int pid, int page, unsigned *buf)
-{ 
-  // reference the previous code for this part
-  // but previous code was not fully completed
-	  sem_wait(&disk_mutex);
-	int location, ret, retsize, k;
+int numSlots;   // maxProcess*maxPpages, every page may get a slot
+unsigned *slotMap;   // 1 bit per slot, set if the slot is in use
+int *swapSlot;   // [pid*maxPpages + page], slot of the page, nullIndex if none
+int slotsUsed = 0, slotHigh = 0;   // slots in use, file size in slots
+int slotsReused = 0;   // for statistics
 
-	  if (pid < 2 || pid > maxProcess)
-	  { printf ("Error: Incorrect pid for disk read: %d\n", pid);
-	    return (-1);
+// the caller holds slot_mutex (dedup.c: dedup_mutex, it has its own slots)
+// a new page never finds all the slots used, since it has no slot itself
+int alloc_swap_slot (int hint)
+{ int w, b, slot;
+
+  // hint: the slot after the previous page, keeps a process consecutive
+  if (hint >= 0 && hint < numSlots && !(slotMap[hint/32] & (1u << (hint%32))))
+    slot = hint;
+  else
+  { for (w=0; slotMap[w] == ~0u; w++)
+      ;
+    for (b=0; slotMap[w] & (1u << b); b++)
+      ;
+    slot = w*32 + b;
+  }
+  slotMap[slot/32] |= 1u << (slot%32);
+  slotsUsed++;
+  if (slot < slotHigh) slotsReused++;
+  else slotHigh = slot+1;
+  return (slot);
+}
+
+// the first of n consecutive free slots, for the new pages of a request
+// (e.g., a program image), nullIndex if there is no such run
+int free_swap_run (int n)
+{ int slot, len = 0;
+
+  for (slot=0; slot<numSlots; slot++)
+  { if (slotMap[slot/32] & (1u << (slot%32))) len = 0;
+    else if (++len == n) return (slot-n+1);
+  }
+  return (nullIndex);
+}
+
+void free_swap_slot (int slot)
+{
+  slotMap[slot/32] &= ~(1u << (slot%32));
+  slotsUsed--;
+}
+
+// process_one_swap: actDrop of a terminated process
+void release_swap_slots (int pid)
+{ int page, *slot = &swapSlot[pid*maxPpages];
+
+  sem_wait(&slot_mutex);
+  for (page=0; page<maxPpages; page++)
+    if (slot[page] != nullIndex)
+    { free_swap_slot (slot[page]);
+      slot[page] = nullIndex;
+    }
+  sem_post(&slot_mutex);
+}
+
+// the slot of a page for the writeback order (paging.c), nullIndex if the
+// page has none yet (or with dedup, which has its own slots)
+int swap_page_slot (int pid, int page)
+{ int slot;
+
+  sem_wait(&slot_mutex);
+  slot = swapSlot[pid*maxPpages + page];
+  sem_post(&slot_mutex);
+  return (slot);
+}
+
+void dump_swap_slots ()
+{
+  printf ("Swap slots: %d in use, file %d slots, %d reused\n",
+          slotsUsed, slotHigh, slotsReused);
+}
+
+// read or write (act) npages consecutive pages of pid from/to bufv[]
+// a write gives a slot to the pages without one, then each run of pages
+// in consecutive slots is transferred with one IO.  The requests on the
+// same pages are processed one at a time (see next_swap_request), so the
+// slots do not change during the IO, the slot table is only locked to
+// look them up.
+// new pages that do not follow the previous page get a run of free slots
+void swap_page_slots (int pid, int page, int npages, int act, int *slots)
+{ int *slot = &swapSlot[pid*maxPpages + page];
+  int k, n, hint;
+
+  sem_wait(&slot_mutex);
+  if (act == actWrite)
+    for (k=0; k<npages; k++)
+      if (slot[k] == nullIndex)
+      { hint = (page+k > 0 && slot[k-1] != nullIndex) ? slot[k-1]+1 : nullIndex;
+        if (hint == nullIndex || slotMap[hint/32] & (1u << (hint%32)))
+        { for (n=1; k+n<npages && slot[k+n] == nullIndex; n++)
+            ;
+          if (n > 1) hint = free_swap_run (n);
+        }
+        slot[k] = alloc_swap_slot (hint);
+      }
+  for (k=0; k<npages; k++) slots[k] = slot[k];
+  sem_post(&slot_mutex);
+}
+
+// npages pages in slots[] from/to bufv[], slots without a page are zeros
+void swap_slots_io (int npages, int *slots, unsigned **bufv, int act)
+{ struct iovec iov[npages];
+  int k, n, retsize;
+
+	  for (k=0; k<npages; k+=n)
+	  { if (slots[k] == nullIndex)   // never written, a zero page
+	    { memset (bufv[k], 0, pagedataSize);
+	      n = 1;
+	      continue;
+	    }
+	    for (n=0; k+n<npages && slots[k+n] == slots[k]+n; n++)
+	    { iov[n].iov_base = bufv[k+n]; iov[n].iov_len = pagedataSize; }
+	    if (act == actRead)
+	      retsize = preadv (diskfd, iov, n, (off_t)slots[k]*pagedataSize);
+	    else retsize = pwritev (diskfd, iov, n, (off_t)slots[k]*pagedataSize);
+	    if (retsize != n*pagedataSize)
+	    { printf ("Error: Disk IO returned incorrect size: %d\n", retsize);
+	      exit(-1);
+	    }
+	    usleep (diskRWtime);
 	  }
-	  location = (pid-2) * PswapSize + page*pagedataSize;
-	  ret = lseek (diskfd, location, SEEK_SET);
-	  if (ret < 0) perror ("Error lseek in read: \n");
-	  retsize = read (diskfd, (char *)buf, pagedataSize);
-	  if (retsize != pagedataSize)
-	  { printf ("Error: Disk read returned incorrect size: %d\n", retsize);
-	    exit(-1);
+}
+
+int swap_page_io (int pid, int page, int npages, unsigned **bufv, int act)
+{ int slots[npages];
+
+	  if (pid < 2 || pid >= maxProcess)
+	  { printf ("Error: Incorrect pid for disk IO: %d\n", pid);
+	    return (-1);
 	  }
-	  usleep (diskRWtime);
-	  sem_post(&disk_mutex);
+	  swap_page_slots (pid, page, npages, act, slots);
+	  swap_slots_io (npages, slots, bufv, act);
 	  return mNormal;
 }
 
+int read_swap_page (int pid, int page, int npages, unsigned *buf)
+{ 
+	unsigned *bufv[npages];
+	int k;
 
-int write_swap_page (int pid, int page, unsigned *buf)
+	  if (swapDedup)
+	  { for (k=0; k<npages; k++) dedup_read (pid, page+k, buf+k*pageSize, 1);
+	    return mNormal;
+	  }
+	  for (k=0; k<npages; k++) bufv[k] = buf + k*pageSize;
+	  return (swap_page_io (pid, page, npages, bufv, actRead));
+}
+
+
+int write_swap_page (int pid, int page, int npages, unsigned *buf)
 { 
-  // reference the previous code for this part
-  // but previous code was not fully completed
-	  sem_wait(&disk_mutex);
-	int location, ret, retsize;
+	unsigned *bufv[npages];
+	int k;
 
-	  if (pid < 2 || pid > maxProcess)
-	  { printf ("Error: Incorrect pid for disk write: %d\n", pid);
-	    return (-1);
+	  if (swapDedup)
+	  { for (k=0; k<npages; k++) dedup_write (pid, page+k, buf+k*pageSize);
+	    return mNormal;
+	  }
+	  for (k=0; k<npages; k++) bufv[k] = buf + k*pageSize;
+	  return (swap_page_io (pid, page, npages, bufv, actWrite));
+}
+
+
+// read or write (act) npages consecutive swap pages of pid from/to npages
+// separate buffers (e.g., frames that are not contiguous)
+int swap_cluster_io (int pid, int page, int npages, unsigned **bufv, int act)
+{ 
+	  int k;
+
+	  if (swapDedup)   // the pages are not consecutive in the slot pool
+	  { for (k=0; k<npages; k++)
+	      if (act == actRead) dedup_read (pid, page+k, bufv[k], 1);
+	      else dedup_write (pid, page+k, bufv[k]);
+	    return mNormal;
 	  }
-	  location = (pid-2) * PswapSize + page*pagedataSize;
-	  ret = lseek (diskfd, location, SEEK_SET);
-	  if (ret < 0) perror ("Error lseek in write: \n");
-	  retsize = write (diskfd, (char *)buf, pagedataSize);
+	  return (swap_page_io (pid, page, npages, bufv, act));
+}
+
+
+// one slot, for the content addressed swap store (dedup.c) and the dumps
+void read_swap_slot (int slot, unsigned *buf)
+{ int retsize;
+
+	  retsize = pread (diskfd, (char *)buf, pagedataSize,
+	                   (off_t)slot*pagedataSize);
 	  if (retsize != pagedataSize)
-	    { printf ("Error: Disk read returned incorrect size: %d\n", retsize);
-	      exit(-1);
-	    }
+	  { printf ("Error: Disk slot read returned incorrect size: %d\n", retsize);
+	    exit(-1);
+	  }
+	  usleep (diskRWtime);
+}
+
+void write_swap_slot (int slot, unsigned *buf)
+{ int retsize;
+
+	  retsize = pwrite (diskfd, (char *)buf, pagedataSize,
+	                    (off_t)slot*pagedataSize);
+	  if (retsize != pagedataSize)
+	  { printf ("Error: Disk slot write returned incorrect size: %d\n", retsize);
+	    exit(-1);
+	  }
 	  usleep (diskRWtime);
-	  sem_post(&disk_mutex);
-	  return mNormal;
 }
 
 
@@ -89,27 +258,26 @@ int dump_process_swap_page (int pid, int page)
 { 
   // reference the previous code for this part
   // but previous code was not fully completed
-	  sem_wait(&disk_mutex);
-	  int location, ret, retsize, k;
-	  int buf[pageSize];
+	  int slot, k;
+	  unsigned buf[pageSize];
 
-	  if (pid < 2 || pid > maxProcess)
+	  if (pid < 2 || pid >= maxProcess)
 	  { printf ("Error: Incorrect pid for disk dump: %d\n", pid);
 		return (-1);
 	  }
-	  location = (pid-2) * PswapSize + page*pagedataSize;
-	  ret = lseek (diskfd, location, SEEK_SET);
-	  //printf ("loc %d %d %d, size %d\n", pid, page, location, pagedataSize);
-	  if (ret < 0) perror ("Error lseek in dump: \n");
-	  retsize = read (diskfd, (char *)buf, pagedataSize);
-	  if (retsize != pagedataSize)
-	  { printf ("Error: Disk dump read incorrect size: %d\n", retsize);
-		exit(-1);
-	  }
-	  printf ("Content of process %d page %d:\n", pid, page);
+	  sem_wait(&slot_mutex);   // the swap workers may be changing it
+	  slot = swapSlot[pid*maxPpages + page];
+	  sem_post(&slot_mutex);
+	  if (swapDedup) dedup_read (pid, page, buf, 0);
+	  else if (slot == nullIndex) memset (buf, 0, pagedataSize);
+	  else read_swap_slot (slot, buf);
+	  // the cached page is newer than the disk copy
+	  if (zswapSize > 0 && zswap_peek (pid, page, buf))
+	    printf ("Content of process %d page %d (compressed cache):\n", pid, page);
+	  else printf ("Content of process %d page %d:\n", pid, page);
 	  for (k=0; k<pageSize; k++) printf ("%x ", buf[k]);
 	  printf ("\n");
-	  sem_post(&disk_mutex);
+	  return (0);
 }
 
 void dump_process_swap (int pid)
@@ -119,26 +287,20 @@ void dump_process_swap (int pid)
   for (j=0; j<maxPpages; j++) dump_process_swap_page (pid, j);
 }
 
-// open the file with the swap space size, initialize content to 0
+// open the file, it is empty, the slots are given out as pages are written
 void initialize_swap_space ()
-{ int ret, i, j, k;
-  int buf[pageSize];
+{ int i;
 
-  swapspaceSize = maxProcess*maxPpages*pageSize*dataSize;
-  PswapSize = maxPpages*pageSize*dataSize;
   pagedataSize = pageSize*dataSize;
+  numSlots = maxProcess*maxPpages;
+  slotMap = (unsigned *) calloc ((numSlots+31)/32, sizeof(unsigned));
+  swapSlot = (int *) malloc (numSlots*sizeof(int));
+  for (i=0; i<numSlots; i++) swapSlot[i] = nullIndex;
 
   diskfd = open (swapFname, O_RDWR | O_CREAT, 0600);
   if (diskfd < 0) { perror ("Error open: "); exit (-1); }
-  ret = lseek (diskfd, swapspaceSize, SEEK_SET); 
-  if (ret < 0) { perror ("Error lseek in open: "); exit (-1); }
-  for (i=2; i<maxProcess; i++)
-    for (j=0; j<maxPpages; j++)
-    { for (k=0; k<pageSize; k++) buf[k]=0;
-      write_swap_page (i, j, buf);
-    }
-    // last parameter is the origin, offset from the origin, which can be:
-    // SEEK_SET: 0, SEEK_CUR: from current position, SEEK_END: from eof
+  if (ftruncate (diskfd, 0) < 0) { perror ("Error truncate: "); exit (-1); }
+  if (swapDedup) initialize_dedup ();
 }
 
 
@@ -157,8 +319,15 @@ void initialize_swap_space ()
 //===================================================
 
 typedef struct SwapQnodeStruct
-{ int pid, page, act, finishact;
+{ int pid, page, npages, act, finishact;
   unsigned *buf;
+  unsigned **bufv;   // npages separate buffers, NULL if buf is used
+  unsigned *src;   // actCopy: page copied to buf, NULL for a zero page
+  int busy;   // being processed by a swap worker, still in the queue
+  int pending;   // io_uring: #IOs not completed
+  struct iovec *iov;   // io_uring: the pages of the IOs, NULL if none
+  int queued;   // swapDispatched when it was queued, for the deadlines
+  struct SwapQnodeStruct *merged;   // next request merged into its IO
   struct SwapQnodeStruct *next;
 } SwapQnode;
 // pidin, pagein, inbuf: for the page with PF, needs to be brought in
@@ -169,9 +338,61 @@ typedef struct SwapQnodeStruct
 SwapQnode *swapQhead = NULL;
 SwapQnode *swapQtail = NULL;
 
+//===================================================
+// The I/O scheduler picks the next request among those that can go now
+// (see next_swap_request for the ordering rules), swapSched is:
+//   fifoSched: the oldest one, the queue order
+//   clookSched: C-LOOK elevator, the one at the lowest swap file offset
+//     at or after the last IO, or the lowest offset if none
+//   deadlineSched: C-LOOK, but a request that has waited for more than
+//     readExpire (reads) or writeExpire (writes) dispatched requests goes
+//     first, so the reads do not wait long behind a stream of writes
+// With clookSched and deadlineSched, the requests going in the same
+// direction to the swap slots right after the chosen one are merged into
+// its IO (one preadv/pwritev).  The requests without disk IO go as soon as
+// they can.  zswap and dedup keep the queue order, their pages are not
+// at a swap file offset.
+//===================================================
+
+#define fifoSched 0
+#define clookSched 1
+#define deadlineSched 2
+
+int swapHeadSlot = 0;   // the slot after the last IO, for C-LOOK
+int swapDispatched = 0;   // #requests given to a worker
+int swapQdepth = 0, swapQmaxDepth = 0;   // for statistics
+int swapMerged = 0, swapMergedIOs = 0, swapExpired = 0;
+
+// Fault reads (finishact toReady) unblock a process, with swapReadPrio > 0
+// they go ahead of the other requests (loader writes, evictions), up to
+// swapReadPrio times in a row while an older request could go, so the
+// writes are not starved.  A fault read that has to wait (e.g., for the
+// eviction of its frame, or a write of the same page, see swap_conflict)
+// gives its priority to the request it waits for, so it never reads
+// stale data and still does not wait behind unrelated writes.
+int swapReadsAhead = 0;   // fault reads dispatched ahead in a row
+int swapPrioPick = 0;   // the last next_swap_request went ahead
+int swapPrioReads = 0;   // for statistics
+
+void append_swapQ (SwapQnode *node)
+{
+	node->busy = 0;
+	node->iov = NULL;
+	node->queued = swapDispatched;
+	node->merged = NULL;
+	node->next = NULL;
+	if (swapQtail == NULL) // swapQhead would be NULL also
+	    { swapQtail = node; swapQhead = node; }
+	  else // insert to tail
+	    { swapQtail->next = node; swapQtail = node; }
+	swapQdepth++;
+	if (swapQdepth > swapQmaxDepth) swapQmaxDepth = swapQdepth;
+}
+
 void print_one_swapnode (SwapQnode *node)
-{ printf ("pid,page=(%d,%d), act,fact=(%d, %d), buf=%x\n",
-           node->pid, node->page, node->act, node->finishact, node->buf);
+{ printf ("pid,page=(%d,%d), npages=%d, act,fact=(%d, %d), buf=%x\n",
+           node->pid, node->page, node->npages, node->act, node->finishact,
+           node->buf);
 }
 
 
@@ -180,6 +401,11 @@ void dump_swapQ ()
   // dump all the nodes in the swapQ
 	SwapQnode *node;
 	  printf ("******************** Swap Queue Dump\n");
+	  printf ("depth = %d (max %d), dispatched = %d, expired = %d",
+	          swapQdepth, swapQmaxDepth, swapDispatched, swapExpired);
+	  printf (", merged = %d requests into %d IOs",
+	          swapMerged, swapMergedIOs);
+	  printf (", fault reads ahead = %d\n", swapPrioReads);
 	  node = swapQhead;
 	  while (node != NULL)
 	    { print_one_swapnode(node);
@@ -195,76 +421,559 @@ void dump_swapQ ()
 void insert_swapQ (pid, page, buf, act, finishact)
 int pid, page, act, finishact;
 unsigned *buf;
+{ 
+	insert_swapQ_pages (pid, page, 1, buf, act, finishact);
+}
+
+// same as insert_swapQ, for npages consecutive pages in one request
+// buf has to hold npages pages, e.g., contiguous memory frames
+
+void insert_swapQ_pages (pid, page, npages, buf, act, finishact)
+int pid, page, npages, act, finishact;
+unsigned *buf;
 { 
 	SwapQnode *node;
 	sem_wait(&swapq_mutex);
-	if (Debug) printf ("Insert swap queue pid,page=(%d,%d), act,fact=(%d, %d), buf=%x\n", pid, page, act, finishact, buf);
+	if (Debug) printf ("Insert swap queue pid,page=(%d,%d), npages=%d, act,fact=(%d, %d), buf=%x\n", pid, page, npages, act, finishact, buf);
 	node = (SwapQnode *) malloc (sizeof (SwapQnode));
 	node->pid = pid;
 	node->page = page;
+	node->npages = npages;
 	node->buf = buf;
+	node->bufv = NULL;
+	node->src = NULL;
 	node->act = act;
 	node->finishact = finishact;
-	node->next = NULL;
-	if (swapQtail == NULL) // termQhead would be NULL also
-	    { swapQtail = node; swapQhead = node; }
-	  else // insert to tail
-	    { swapQtail->next = node; swapQtail = node; }
+	append_swapQ (node);
 	if (Debug) dump_swapQ ();
 	sem_post(&swapq_mutex);
 	sem_post(&swap_semaq);
 }
 
+// one request for npages consecutive pages in separate buffers bufv[]
+// swap.c frees bufv when the request is done, and the buffers if freeBuf
 
-void process_one_swap ()
-{ // get one request from the head of the swap queue and process it
-  // if (pid >= 2 && page >= 0) error
-    // call write_swap_page to write the dirty page out
-  // call read_swap_page to read in the needed page
-  // after finishing return the process to ready queue and set interrup
+void insert_swapQ_cluster (pid, page, npages, bufv, act, finishact)
+int pid, page, npages, act, finishact;
+unsigned **bufv;
+{ 
+	SwapQnode *node;
+	sem_wait(&swapq_mutex);
+	if (Debug) printf ("Insert swap queue pid,page=(%d,%d), cluster=%d, act,fact=(%d, %d)\n", pid, page, npages, act, finishact);
+	node = (SwapQnode *) malloc (sizeof (SwapQnode));
+	node->pid = pid;
+	node->page = page;
+	node->npages = npages;
+	node->buf = bufv[0];
+	node->bufv = bufv;
+	node->src = NULL;
+	node->act = act;
+	node->finishact = finishact;
+	append_swapQ (node);
+	if (Debug) dump_swapQ ();
+	sem_post(&swapq_mutex);
+	sem_post(&swap_semaq);
+}
+
+
+// the buffer of page k of the request
+unsigned *request_page_buf (SwapQnode *node, int k)
+{ if (node->bufv != NULL) return (node->bufv[k]);
+  return (node->buf + k*pageSize);
+}
+
+// with the compressed swap cache (zswap.c), the written pages go to the
+// cache, zswap_read only reads the pages that are not cached from the disk
+void swap_read_request (SwapQnode *node)
+{ unsigned *bufv[node->npages];
+  int k;
+
+  for (k=0; k<node->npages; k++) bufv[k] = request_page_buf (node, k);
+  if (zswapSize > 0) zswap_read (node->pid, node->page, node->npages, bufv);
+  else swap_cluster_io (node->pid, node->page, node->npages, bufv, actRead);
+}
+
+// one IO for a request and the requests merged into it (the scheduler)
+void swap_merged_request (SwapQnode *node)
+{ SwapQnode *e;
+  int n = 0, k;
+
+  for (e=node; e!=NULL; e=e->merged) n += e->npages;
+  { int slots[n];
+    unsigned *bufv[n];
+
+    n = 0;
+    for (e=node; e!=NULL; e=e->merged)
+    { swap_page_slots (e->pid, e->page, e->npages, e->act, slots+n);
+      for (k=0; k<e->npages; k++) bufv[n+k] = request_page_buf (e, k);
+      n += e->npages;
+    }
+    swap_slots_io (n, slots, bufv, node->act);
+  }
+}
+
+void swap_write_request (SwapQnode *node)
+{ int k;
+
+  if (zswapSize > 0)
+  { for (k=0; k<node->npages; k++)
+      zswap_store (node->pid, node->page+k, request_page_buf (node, k));
+    return;
+  }
+  if (node->bufv != NULL)
+    swap_cluster_io (node->pid, node->page, node->npages, node->bufv, actWrite);
+  else write_swap_page (node->pid, node->page, node->npages, node->buf);
+}
+
+
+int swap_conflict (SwapQnode *e, SwapQnode *node);
+
+// fill buf (a memory frame) with page src or zeros, without any disk IO
+// if no request in the queue is on the frame (e.g., the write of its old
+// page) or on src, it is filled right away and 0 is returned, finishact
+// is up to the caller; otherwise it is filled in the queue order, 1
+
+int insert_swapQ_copy (pid, page, buf, src, finishact)
+int pid, page, finishact;
+unsigned *buf, *src;
+{ 
+	SwapQnode *node, *e;
+	sem_wait(&swapq_mutex);
+	if (Debug) printf ("Insert swap queue pid,page=(%d,%d), copy=%x, fact=%d\n", pid, page, src, finishact);
+	node = (SwapQnode *) malloc (sizeof (SwapQnode));
+	node->pid = pid;
+	node->page = page;
+	node->npages = 1;
+	node->buf = buf;
+	node->bufv = NULL;
+	node->src = src;
+	node->act = actCopy;
+	node->finishact = Nothing;   // only the requests on the same memory
+	for (e=swapQhead; e!=NULL && !swap_conflict (e, node); e=e->next);
+	if (e == NULL)
+	{ if (src != NULL) memcpy (buf, src, pagedataSize);
+	  else memset (buf, 0, pagedataSize);
+	  free (node);
+	  sem_post(&swapq_mutex);
+	  return (0);
+	}
+	node->finishact = finishact;
+	append_swapQ (node);
+	if (Debug) dump_swapQ ();
+	sem_post(&swapq_mutex);
+	sem_post(&swap_semaq);
+	return (1);
+}
+
+
+//===================================================
+// swapWorkers threads process the queue.  A request is taken by a worker
+// as soon as it does not conflict with an earlier request still in the
+// queue (waiting or being processed), so the requests of different
+// processes on different frames overlap their disk time, while the
+// ordering the paging code relies on is kept:
+//   the requests of a pid on the same pages are processed in the queue
+//     order, its actDrop and a request with toReady (e.g., a fault read)
+//     wait for all its earlier requests
+//   the requests on the same memory (frame, buffer, actCopy source) are
+//     processed in the queue order, e.g., a frame is written out before
+//     the next page is read into it
+//   actNone (e.g., toReady after the shared text frames) waits for all
+//     the earlier requests
+// With swapWorkers = 1, the queue is processed in order, one at a time.
+//===================================================
+
+// does memory [p, p+n pages) overlap the buffers of request node
+int swap_buffer_overlap (SwapQnode *node, unsigned *p, int n)
+{ unsigned *b;
+  int k;
+
+  if (p == NULL) return (0);
+  if (node->src != NULL && p < node->src+pageSize && node->src < p+n*pageSize)
+    return (1);
+  for (k=0; k<node->npages; k++)
+  { b = request_page_buf (node, k);
+    if (b != NULL && p < b+pageSize && b < p+n*pageSize) return (1);
+  }
+  return (0);
+}
+
+// request node has to wait for the earlier request e
+int swap_conflict (SwapQnode *e, SwapQnode *node)
+{ int k;
+
+  if (node->act == actNone) return (1);
+  if (e->pid == node->pid)
+  { if (node->finishact == toReady || node->act == actDrop
+        || e->act == actDrop) return (1);
+    if (node->page < e->page+e->npages && e->page < node->page+node->npages)
+      return (1);
+  }
+  if (node->src != NULL && swap_buffer_overlap (e, node->src, 1)) return (1);
+  if (node->bufv == NULL)
+    return (swap_buffer_overlap (e, node->buf, node->npages));
+  for (k=0; k<node->npages; k++)
+    if (swap_buffer_overlap (e, node->bufv[k], 1)) return (1);
+  return (0);
+}
+
+// can request node be processed now (no earlier request it waits for)
+int swap_request_ready (SwapQnode *node)
+{ SwapQnode *e;
+
+  if (node->busy) return (0);
+  for (e=swapQhead; e!=node && !swap_conflict (e, node); e=e->next);
+  return (e == node);
+}
+
+// is the request scheduled by its swap file offset (the I/O scheduler)
+int swap_sched_io (SwapQnode *node)
+{
+  return (swapSched != fifoSched && zswapSize == 0 && !swapDedup
+          && (node->act == actRead || node->act == actWrite)
+          && node->pid >= 2 && node->pid < maxProcess);
+}
+
+// the slot of the first page of the request that has one, nullIndex if
+// none (no disk IO for a read), a write of new pages is put at slotHigh
+int swap_sched_slot (SwapQnode *node)
+{ int *slot = &swapSlot[node->pid*maxPpages + node->page];
+  int k, ret = nullIndex;
+
+  sem_wait(&slot_mutex);
+  for (k=0; k<node->npages && slot[k] == nullIndex; k++);
+  if (k < node->npages) ret = slot[k];
+  else if (node->act == actWrite) ret = slotHigh;
+  sem_post(&slot_mutex);
+  return (ret);
+}
+
+// the slot after the request if all its pages are in consecutive slots,
+// so a request starting there can be merged into its IO, else nullIndex
+int swap_merge_end (SwapQnode *node)
+{ int *slot = &swapSlot[node->pid*maxPpages + node->page];
+  int k, ret = nullIndex;
+
+  sem_wait(&slot_mutex);
+  for (k=0; k<node->npages && slot[k] != nullIndex && slot[k] == slot[0]+k;
+       k++);
+  if (k == node->npages) ret = slot[0] + node->npages;
+  sem_post(&slot_mutex);
+  return (ret);
+}
+
+// does request e start at slot end, so it can be merged into the IO
+// ending there.  A write of new pages right after the previous page of
+// its process gets its slots now, the allocator puts them at end if free.
+int swap_merge_at (SwapQnode *e, int end)
+{ int *slot = &swapSlot[e->pid*maxPpages + e->page];
+  int slots[e->npages];
+  int fresh;
+
+  sem_wait(&slot_mutex);
+  fresh = (e->act == actWrite && slot[0] == nullIndex && e->page > 0
+           && slot[-1] == end-1);
+  sem_post(&slot_mutex);
+  if (fresh) swap_page_slots (e->pid, e->page, e->npages, actWrite, slots);
+  return (swap_merge_end (e) == end + e->npages);
+}
+
+int swap_expired (SwapQnode *node)
+{
+  return (swapSched == deadlineSched && swapDispatched - node->queued >
+          (node->act == actRead ? readExpire : writeExpire));
+}
+
+// the first waiting request node waits for, NULL if it only waits for
+// requests being processed
+SwapQnode *swap_blocker (SwapQnode *node)
+{ SwapQnode *e;
+
+  for (e=swapQhead; e!=node; e=e->next)
+    if (!e->busy && swap_conflict (e, node)) return (e);
+  return (NULL);
+}
+
+// the oldest fault read that can go, else a request the oldest waiting
+// one waits for, directly or through other requests (e.g., the read of
+// another page to its frame, or the writes of a program being loaded)
+SwapQnode *fault_swap_request ()
+{ SwapQnode *node, *e;
+
+  for (node=swapQhead; node!=NULL; node=node->next)
+    if (node->finishact == toReady && swap_request_ready (node))
+      return (node);
+  for (node=swapQhead; node!=NULL; node=node->next)
+  { if (node->busy || node->finishact != toReady) continue;
+    for (e=node; e!=NULL && !swap_request_ready (e); e=swap_blocker (e));
+    if (e != NULL) return (e);
+  }
+  return (NULL);
+}
+
+// the request the scheduler (swapSched) picks among those that can go
+SwapQnode *sched_swap_request ()
+{ SwapQnode *node, *best = NULL;
+  int slot, key, bestKey = 0;
+
+  for (node=swapQhead; node!=NULL; node=node->next)
+  { if (!swap_request_ready (node)) continue;
+    if (!swap_sched_io (node) || swap_expired (node)) return (node);
+    slot = swap_sched_slot (node);
+    if (slot == nullIndex) return (node);
+    // C-LOOK: from the head position up, then wrap to the lowest slot
+    key = (slot >= swapHeadSlot) ? slot : slot + numSlots;
+    if (best == NULL || key < bestKey) { best = node; bestKey = key; }
+  }
+  return (best);
+}
+
+// the next request that can be processed now, called with swapq_mutex
+SwapQnode *next_swap_request ()
+{ SwapQnode *node, *fault;
+
+  node = sched_swap_request ();
+  swapPrioPick = 0;
+  if (swapReadPrio > 0 && swapReadsAhead < swapReadPrio)
+  { fault = fault_swap_request ();
+    if (fault != NULL && fault != node)
+    { swapPrioPick = 1;
+      return (fault);
+    }
+  }
+  return (node);
+}
+
+// chain the ready requests in the same direction at the slots right after
+// node (merged), the merged IO has at most maxPpages pages
+void merge_swap_requests (SwapQnode *node)
+{ SwapQnode *last = node, *e;
+  int end, npages = node->npages;
+  int slots[npages];
+
+  if (node->act == actWrite)   // its new pages get their slots now
+    swap_page_slots (node->pid, node->page, npages, actWrite, slots);
+  end = swap_merge_end (node);
+  while (end != nullIndex)
+  { for (e=swapQhead; e!=NULL; e=e->next)
+      if (e->act == node->act && npages + e->npages <= maxPpages
+          && swap_sched_io (e) && swap_request_ready (e)
+          && swap_merge_at (e, end)) break;
+    if (e == NULL) break;
+    e->busy = 1;
+    last->merged = e;
+    last = e;
+    npages += e->npages;
+    end += e->npages;
+    swapMerged++;
+  }
+  if (node->merged != NULL) swapMergedIOs++;
+  if (end == nullIndex && (end = swap_sched_slot (last)) != nullIndex)
+    end += last->npages;
+  if (end != nullIndex) swapHeadSlot = end;
+}
+
+void remove_swap_request (SwapQnode *node)
+{ SwapQnode *prev = NULL, *e;
+
+  for (e=swapQhead; e!=node; e=e->next) prev = e;
+  if (prev == NULL) swapQhead = node->next;
+  else prev->next = node->next;
+  if (swapQtail == node) swapQtail = prev;
+  swapQdepth--;
+}
+
+// swap_semaq is posted for each new request, each finished request (the
+// requests waiting for it may go) and when a worker takes a request while
+// another one can go too, a worker finding nothing to do waits again
+SwapQnode *take_swap_request ()
+{ SwapQnode *node;
 
-	  SwapQnode *node;
-	  sem_wait(&swap_semaq);
 	  sem_wait(&swapq_mutex);
 	  //if (Debug) dump_swapQ ();
-	  if (swapQhead == NULL)
-	  { //printf ("No process in swap queue!!!\n");
+	  node = next_swap_request ();
+	  if (node != NULL)
+	  { if (swapPrioPick) { swapReadsAhead++; swapPrioReads++; }
+	    else swapReadsAhead = 0;
+	    node->busy = 1;
+	    swapDispatched++;
+	    if (swap_expired (node)) swapExpired++;
+	    if (swap_sched_io (node)) merge_swap_requests (node);
+	    if (next_swap_request () != NULL) sem_post(&swap_semaq);
 	  }
-	  else
-	  { node = swapQhead;
-		if (node->act == actRead)
+	  sem_post(&swapq_mutex);
+	  return (node);
+}
+
+void do_swap_request (SwapQnode *node)
+{
+		if (node->merged != NULL)
+		{
+			swap_merged_request (node);
+		}else if (node->act == actRead)
 		{
-			read_swap_page(node->pid, node->page, node->buf);
+			swap_read_request (node);
 		}else if (node->act == actWrite) {
-			write_swap_page (node->pid, node->page, node->buf);
+			swap_write_request (node);
+		}else if (node->act == actDrop) {
+			if (zswapSize > 0) zswap_drop (node->pid);
+			if (swapDedup) dedup_drop (node->pid);
+			else release_swap_slots (node->pid);
+		}else if (node->act == actCopy) {
+			if (node->src != NULL) memcpy (node->buf, node->src, pagedataSize);
+			else memset (node->buf, 0, pagedataSize);
 		}
+}
 
+// after the IO of the request: finishact, and the requests waiting for it
+// the requests merged into its IO (the scheduler) are finished with it
+void finish_swap_request (SwapQnode *node)
+{ SwapQnode *next;
+  int k;
+
+	for (; node!=NULL; node=next)
+	{ next = node->merged;
 		if(node->finishact == toReady){
 			insert_endWait_process (node->pid);
 			set_interrupt (endWaitInterrupt);
 		}
 
+	  sem_wait(&swapq_mutex);
 		//if (Debug) printf ("Remove swap queue %d %s\n", node->pid, node->str);
-		swapQhead = node->next;
-		if (swapQhead == NULL) swapQtail = NULL;
+		remove_swap_request (node);
 		if(node->finishact == freeBuf){
-			free (node->buf);
+			if (node->bufv != NULL)
+			  for (k=0; k<node->npages; k++) free (node->bufv[k]);
+			else free (node->buf);
 		}
+		if (node->bufv != NULL) free (node->bufv);
+		if (node->iov != NULL) free (node->iov);
 		free (node);
 		if (Debug) dump_swapQ ();
-	  }
 	  sem_post(&swapq_mutex);
+	  sem_post(&swap_semaq);
+	}
+}
+
+void process_one_swap ()
+{ // get one request from the swap queue and process it
+  // call write_swap_page to write the dirty page out
+  // call read_swap_page to read in the needed page
+  // after finishing return the process to ready queue and set interrup
+
+	  SwapQnode *node;
+	  sem_wait(&swap_semaq);
+	  node = take_swap_request ();
+	  if (node == NULL) return;   // no request, or all wait for others
+	  do_swap_request (node);
+	  finish_swap_request (node);
 }
 
 
 void *process_swapQ ()
 {
-  // called as the entry function for the swap thread
+  // called as the entry function for the swap workers
 	while (systemActive) process_one_swap ();
 	printf ("Swap loop has ended\n");
 }
 
-pthread_t swapThread;
+
+//===================================================
+// io_uring backend (swapUring = 1), uring.c: one swap thread takes all
+// the requests that can go (same ordering as the workers), submits the
+// disk IO of all of them with one system call, and finishes a request
+// (toReady, freeBuf) when all the completions of its IO are back.
+// The thread waits on the completion queue, there is no modeled disk
+// time (diskRWtime), the IOs take the time the swap file takes.
+// The requests without plain disk IO (actNone, actCopy, actDrop, and all
+// of them with zswap or dedup, which have their own locking and IO) are
+// processed by the thread as they are taken.
+// Without io_uring (e.g., not allowed), the swap workers are used instead.
+//===================================================
+
+int uringDepth;   // ring entries, bounds the IOs in flight
+int uringBatches = 0, uringIOs = 0;   // for statistics
+
+// queue the IOs of a read/write request, returns its #IOs, -1 if the
+// request has to be processed by do_swap_request
+// the requests merged into node (the scheduler) are in its IOs, a merged
+// IO has at most maxPpages pages
+int uring_swap_request (SwapQnode *node)
+{ SwapQnode *e;
+  int slots[maxPpages];
+  int npages = 0, k, n;
+
+  if ((node->act != actRead && node->act != actWrite)
+      || zswapSize > 0 || swapDedup) return (-1);
+  if (node->pid < 2 || node->pid >= maxProcess)
+  { printf ("Error: Incorrect pid for disk IO: %d\n", node->pid);
+    return (0);
+  }
+  for (e=node; e!=NULL; e=e->merged) npages += e->npages;
+  node->iov = (struct iovec *) malloc (npages*sizeof(struct iovec));
+  n = 0;
+  for (e=node; e!=NULL; e=e->merged)
+  { swap_page_slots (e->pid, e->page, e->npages, e->act, slots+n);
+    for (k=0; k<e->npages; k++)
+    { node->iov[n+k].iov_base = request_page_buf (e, k);
+      node->iov[n+k].iov_len = pagedataSize;
+    }
+    n += e->npages;
+  }
+  node->pending = 0;
+  for (k=0; k<npages; k+=n)
+  { if (slots[k] == nullIndex)   // never written, a zero page
+    { memset (node->iov[k].iov_base, 0, pagedataSize);
+      n = 1;
+      continue;
+    }
+    for (n=1; k+n<npages && slots[k+n] == slots[k]+n; n++);
+    uring_prep (node->act, diskfd, &node->iov[k], n,
+                (long)slots[k]*pagedataSize, node);
+    node->pending++;
+  }
+  return (node->pending);
+}
+
+void *uring_swapQ ()
+{ SwapQnode *node;
+  int inflight = 0, ret, res;
+
+	while (systemActive)
+	{ if (inflight == 0) sem_wait(&swap_semaq);
+	  // a request has at most maxPpages IOs
+	  while (inflight + maxPpages <= uringDepth
+	         && (node = take_swap_request ()) != NULL)
+	  { ret = uring_swap_request (node);
+	    if (ret < 0) do_swap_request (node);
+	    if (ret <= 0) finish_swap_request (node);
+	    else inflight += ret;
+	  }
+	  if (inflight == 0) continue;
+	  // submit the new IOs, wait for at least one completion
+	  ret = uring_submit (1);
+	  if (ret > 0) { uringBatches++; uringIOs += ret; }
+	  while ((node = uring_reap (&res)) != NULL)
+	  { inflight--;
+	    if (res < 0 || res % pagedataSize != 0)
+	    { printf ("Error: Disk IO returned incorrect size: %d\n", res);
+	      exit(-1);
+	    }
+	    if (--node->pending == 0) finish_swap_request (node);
+	  }
+	}
+	printf ("Swap loop has ended\n");
+	return (NULL);
+}
+
+void dump_uring_stats ()
+{
+  if (swapUring && uringBatches > 0)
+    printf ("io_uring swap: batches = %d, IOs = %d, IOs per batch = %.2f\n",
+            uringBatches, uringIOs, (float)uringIOs/uringBatches);
+}
+
+pthread_t *swapThreads;
 
 
 void start_swap_manager ()
@@ -273,25 +982,46 @@ void start_swap_manager ()
   // initialize_swap_space ();
   // create swap thread
 
-	int ret;
+	int ret, i;
 	sem_init(&swap_semaq, 0, 0);
 	sem_init(&swapq_mutex, 0, 1);
-	sem_init(&disk_mutex, 0, 1);
+	sem_init(&slot_mutex, 0, 1);
 	initialize_swap_space();
-	ret = pthread_create (&swapThread, NULL, process_swapQ, NULL);
-	if (ret < 0) printf ("Swap thread creation problem\n");
-	else printf ("Swap thread has been created successsfully\n");
+	if (zswapSize > 0) initialize_zswap();
+	if (swapWorkers < 1) swapWorkers = 1;
+	uringDepth = 64;
+	if (uringDepth < 2*maxPpages) uringDepth = 2*maxPpages;
+	if (swapUring && uring_init (uringDepth))
+	{ swapWorkers = 1;
+	  swapThreads = (pthread_t *) malloc (sizeof(pthread_t));
+	  ret = pthread_create (&swapThreads[0], NULL, uring_swapQ, NULL);
+	  if (ret < 0) printf ("Swap thread creation problem\n");
+	  else printf ("Swap thread has been created successsfully (io_uring)\n");
+	  return;
+	}
+	if (swapUring)
+	{ printf ("io_uring is not available, using %d swap workers\n", swapWorkers);
+	  swapUring = 0;
+	}
+	swapThreads = (pthread_t *) malloc (swapWorkers*sizeof(pthread_t));
+	for (i=0; i<swapWorkers; i++)
+	{ ret = pthread_create (&swapThreads[i], NULL, process_swapQ, NULL);
+	  if (ret < 0) printf ("Swap thread creation problem\n");
+	  else printf ("Swap thread has been created successsfully\n");
+	}
 }
 
 
 void end_swap_manager ()
 { 
-  // terminate the swap thread 
-	  int ret;
-	  sem_post(&swap_semaq);
-	  close (diskfd);
-	  ret = pthread_join (swapThread, NULL);
-	  printf ("Swap thread has terminated %d\n", ret);
+  // terminate the swap workers
+	  int ret, i;
+	  for (i=0; i<swapWorkers; i++) sem_post(&swap_semaq);
+	  for (i=0; i<swapWorkers; i++)
+	  { ret = pthread_join (swapThreads[i], NULL);
+	    printf ("Swap thread has terminated %d\n", ret);
+	  }
+	  close (diskfd);   // after the workers, one may still be doing IO
 }
 
 
@@ -15,6 +15,25 @@ void initialize_system ()
           &periodAgeScan, &termPrintTime, &diskRWtime, str);
   fscanf (fconfig, "%d %d %d %d %d %s\n", &Debug,
           &cpuDebug, &memDebug, &swapDebug, &clockDebug, str);
+  fscanf (fconfig, "%d %s\n", &tlbSize, str);
+  fscanf (fconfig, "%d %d %s\n", &replaceMode, &wsclockWindow, str);
+  fscanf (fconfig, "%d %d %s\n", &ptMode, &ptFanout, str);
+  fscanf (fconfig, "%d %s\n", &hugeFactor, str);
+  fscanf (fconfig, "%d %s\n", &readaheadMax, str);
+  fscanf (fconfig, "%d %s\n", &faultCluster, str);
+  fscanf (fconfig, "%d %s\n", &wsWindow, str);
+  fscanf (fconfig, "%d %d %d %s\n", &localReplace, &pffLow, &pffHigh, str);
+  fscanf (fconfig, "%d %d %s\n", &lowWatermark, &highWatermark, str);
+  fscanf (fconfig, "%d %d %s\n", &writebackBatch, &writebackScans, str);
+  fscanf (fconfig, "%d %s\n", &shareText, str);
+  fscanf (fconfig, "%d %s\n", &zswapSize, str);
+  fscanf (fconfig, "%d %s\n", &ksmPages, str);
+  fscanf (fconfig, "%d %s\n", &swapDedup, str);
+  fscanf (fconfig, "%d %s\n", &swapWorkers, str);
+  fscanf (fconfig, "%d %s\n", &swapUring, str);
+  fscanf (fconfig, "%d %d %d %s\n", &swapSched, &readExpire, &writeExpire,
+          str);
+  fscanf (fconfig, "%d %s\n", &swapReadPrio, str);
   fclose (fconfig);
 
   // all processing has a while loop on systemActive
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "simos.h"
+
+
+//======================================================================
+// A minimal io_uring for the swap disk (swapUring = 1), used by swap.c
+// Only what swap.c needs: readv/writev at an offset, one submission call
+// for all the prepared IOs, and the completions with their request.
+// The ring is used by the swap thread only, there is no locking.
+// The system calls are used directly, liburing is not needed.
+//======================================================================
+
+int ringfd = -1;
+unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+unsigned *cqHead, *cqTail, *cqMask;
+struct io_uring_sqe *sqes;
+struct io_uring_cqe *cqes;
+unsigned sqLocal, sqSubmitted;   // tail of the prepared SQEs, submitted ones
+
+// returns 0 if io_uring is not available (old kernel, seccomp, ...)
+int uring_init (int entries)
+{ struct io_uring_params p;
+  char *sq, *cq;
+  int sqsize, cqsize;
+
+  memset (&p, 0, sizeof(p));
+  ringfd = syscall (__NR_io_uring_setup, entries, &p);
+  if (ringfd < 0) return (0);
+  sqsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  cqsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  { if (cqsize > sqsize) sqsize = cqsize;
+    cqsize = sqsize;
+  }
+  sq = mmap (NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ringfd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) { close (ringfd); return (0); }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) cq = sq;
+  else
+  { cq = mmap (NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ringfd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) { close (ringfd); return (0); }
+  }
+  sqes = mmap (NULL, p.sq_entries*sizeof(struct io_uring_sqe),
+               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ringfd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) { close (ringfd); return (0); }
+  sqHead = (unsigned *) (sq + p.sq_off.head);
+  sqTail = (unsigned *) (sq + p.sq_off.tail);
+  sqMask = (unsigned *) (sq + p.sq_off.ring_mask);
+  sqArray = (unsigned *) (sq + p.sq_off.array);
+  cqHead = (unsigned *) (cq + p.cq_off.head);
+  cqTail = (unsigned *) (cq + p.cq_off.tail);
+  cqMask = (unsigned *) (cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  sqLocal = sqSubmitted = *sqTail;
+  return (1);
+}
+
+// read or write (act) n pages described by iov at offset off of fd
+// the caller does not prepare more IOs than the ring has entries
+void uring_prep (int act, int fd, void *iov, int n, long off, void *data)
+{ unsigned index = sqLocal & *sqMask;
+  struct io_uring_sqe *sqe = &sqes[index];
+
+  memset (sqe, 0, sizeof(*sqe));
+  sqe->opcode = (act == actRead) ? IORING_OP_READV : IORING_OP_WRITEV;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) iov;
+  sqe->len = n;
+  sqe->off = off;
+  sqe->user_data = (unsigned long) data;
+  sqArray[index] = index;
+  sqLocal++;
+}
+
+// submit all the prepared IOs with one call, wait for wait completions
+int uring_submit (int wait)
+{ int n = sqLocal - sqSubmitted;
+  int ret;
+
+  __atomic_store_n (sqTail, sqLocal, __ATOMIC_RELEASE);
+  ret = syscall (__NR_io_uring_enter, ringfd, n, wait,
+                 wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (ret < 0) { perror ("Error io_uring_enter: "); exit (-1); }
+  sqSubmitted = sqLocal;
+  return (ret);
+}
+
+// the next completion, returns its data (NULL if none), res: bytes or -errno
+void *uring_reap (int *res)
+{ unsigned head = *cqHead;
+  struct io_uring_cqe *cqe;
+  void *data;
+
+  if (head == __atomic_load_n (cqTail, __ATOMIC_ACQUIRE)) return (NULL);
+  cqe = &cqes[head & *cqMask];
+  *res = cqe->res;
+  data = (void *) (unsigned long) cqe->user_data;
+  __atomic_store_n (cqHead, head+1, __ATOMIC_RELEASE);
+  return (data);
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <semaphore.h>
+#include "simos.h"
+
+
+//======================================================================
+// Compressed swap cache (zswapSize > 0), used by the swap manager (swap.c)
+// A page written to swap is compressed and kept in a pool of at most
+// zswapSize bytes instead of going to the disk, a read of a cached page
+// is served from the pool without any disk IO.  When the pool is full,
+// its least recently used pages are written to the disk.  A page that
+// does not compress to less than a page is written to the disk directly.
+// A cached page stays in the pool after it is read, since the page is not
+// written again if it is replaced clean, the pool always has the newest
+// content of its pages, the disk copy may be stale.
+// All the functions, but the dumps, are called by the swap workers.
+//======================================================================
+
+// the compressor works on words (memory units): 2 bits tag per word
+// zero word, same word as the previous one, or a word kept as it is
+// the tags come first (4 per byte), then the words kept
+#define tagZero 0
+#define tagRepeat 1
+#define tagRaw 2
+
+typedef struct ZswapEntryStruct
+{ int pid, page, size;
+  unsigned char *data;   // compressed page
+  struct ZswapEntryStruct *prev, *next;   // lru list, head is the newest
+} ZswapEntry;
+
+ZswapEntry **zswapTable;   // [pid*maxPpages + page], NULL if not cached
+ZswapEntry *zswapHead = NULL, *zswapTail = NULL;
+int zswapBytes = 0, zswapPages = 0;   // current size of the pool
+int zswapStores = 0, zswapRejects = 0, zswapEvicts = 0;   // for statistics
+int zswapHits = 0, zswapMisses = 0;
+long zswapInBytes = 0, zswapOutBytes = 0;   // of all the compressed pages
+
+sem_t zswap_mutex;
+
+int zswap_compress (unsigned *page, unsigned char *out)
+{ int ntags = (pageSize+3)/4;
+  unsigned char *raw = out + ntags;
+  int i, tag;
+
+  memset (out, 0, ntags);
+  for (i=0; i<pageSize; i++)
+  { if (page[i] == 0) tag = tagZero;
+    else if (i > 0 && page[i] == page[i-1]) tag = tagRepeat;
+    else
+    { tag = tagRaw;
+      memcpy (raw, &page[i], sizeof(unsigned));
+      raw += sizeof(unsigned);
+    }
+    out[i/4] |= tag << ((i%4)*2);
+  }
+  return (raw - out);
+}
+
+void zswap_decompress (unsigned char *in, unsigned *page)
+{ unsigned char *raw = in + (pageSize+3)/4;
+  int i, tag;
+
+  for (i=0; i<pageSize; i++)
+  { tag = (in[i/4] >> ((i%4)*2)) & 3;
+    if (tag == tagZero) page[i] = 0;
+    else if (tag == tagRepeat) page[i] = page[i-1];
+    else
+    { memcpy (&page[i], raw, sizeof(unsigned));
+      raw += sizeof(unsigned);
+    }
+  }
+}
+
+void zswap_unlink (ZswapEntry *e)
+{
+  if (e->prev == NULL) zswapHead = e->next;
+  else e->prev->next = e->next;
+  if (e->next == NULL) zswapTail = e->prev;
+  else e->next->prev = e->prev;
+}
+
+void zswap_push (ZswapEntry *e)
+{
+  e->prev = NULL;
+  e->next = zswapHead;
+  if (zswapHead == NULL) zswapTail = e;
+  else zswapHead->prev = e;
+  zswapHead = e;
+}
+
+void zswap_remove (ZswapEntry *e)
+{
+  zswap_unlink (e);
+  zswapTable[e->pid*maxPpages + e->page] = NULL;
+  zswapBytes -= e->size;
+  zswapPages--;
+  free (e->data);
+  free (e);
+}
+
+// write the least recently used page to the disk
+void zswap_evict ()
+{ ZswapEntry *e = zswapTail;
+  unsigned buf[pageSize];
+
+  zswap_decompress (e->data, buf);
+  write_swap_page (e->pid, e->page, 1, buf);
+  zswap_remove (e);
+  zswapEvicts++;
+}
+
+void zswap_store (int pid, int page, unsigned *buf)
+{ unsigned char out[pageSize*sizeof(unsigned) + (pageSize+3)/4];
+  ZswapEntry *e;
+  int size;
+
+  sem_wait (&zswap_mutex);
+  e = zswapTable[pid*maxPpages + page];
+  if (e != NULL) zswap_remove (e);
+  size = zswap_compress (buf, out);
+  if (size >= pageSize*dataSize || size > zswapSize)
+  { write_swap_page (pid, page, 1, buf);
+    zswapRejects++;
+    sem_post (&zswap_mutex);
+    return;
+  }
+  while (zswapBytes + size > zswapSize) zswap_evict ();
+  e = (ZswapEntry *) malloc (sizeof(ZswapEntry));
+  e->pid = pid; e->page = page; e->size = size;
+  e->data = (unsigned char *) malloc (size);
+  memcpy (e->data, out, size);
+  zswap_push (e);
+  zswapTable[pid*maxPpages + page] = e;
+  zswapBytes += size;
+  zswapPages++;
+  zswapStores++;
+  zswapInBytes += pageSize*dataSize;
+  zswapOutBytes += size;
+  sem_post (&zswap_mutex);
+}
+
+// copy a cached page to buf, the caller holds zswap_mutex
+void zswap_load (int pid, int page, unsigned *buf)
+{ ZswapEntry *e = zswapTable[pid*maxPpages + page];
+
+  if (e == NULL) { zswapMisses++; return; }
+  zswap_decompress (e->data, buf);
+  zswap_unlink (e);
+  zswap_push (e);
+  zswapHits++;
+}
+
+// a read request, it only goes to the disk if some of its pages are not
+// cached, the cached pages are copied over what has been read from the
+// disk.  The pool is locked all along, so another swap worker cannot
+// write one of the pages to the disk (evict it) in between.
+void zswap_read (int pid, int page, int npages, unsigned **bufv)
+{ int k;
+
+  sem_wait (&zswap_mutex);
+  for (k=0; k<npages && zswapTable[pid*maxPpages + page+k] != NULL; k++);
+  if (k < npages) swap_cluster_io (pid, page, npages, bufv, actRead);
+  for (k=0; k<npages; k++) zswap_load (pid, page+k, bufv[k]);
+  sem_post (&zswap_mutex);
+}
+
+// the cached pages of a terminated process are not written
+void zswap_drop (int pid)
+{ int page;
+
+  sem_wait (&zswap_mutex);
+  for (page=0; page<maxPpages; page++)
+    if (zswapTable[pid*maxPpages + page] != NULL)
+      zswap_remove (zswapTable[pid*maxPpages + page]);
+  sem_post (&zswap_mutex);
+}
+
+// for the swap dump, copy a cached page without touching the lru list
+int zswap_peek (int pid, int page, unsigned *buf)
+{ ZswapEntry *e;
+
+  sem_wait (&zswap_mutex);
+  e = zswapTable[pid*maxPpages + page];
+  if (e != NULL) zswap_decompress (e->data, buf);
+  sem_post (&zswap_mutex);
+  return (e != NULL);
+}
+
+void dump_zswap_stats ()
+{ int total;
+
+  sem_wait (&zswap_mutex);
+  total = zswapHits + zswapMisses;
+  printf ("Compressed swap cache: %d pages in %d/%d bytes",
+          zswapPages, zswapBytes, zswapSize);
+  if (zswapOutBytes > 0)
+    printf (", compression ratio = %.2f",
+            (float)zswapInBytes/zswapOutBytes);
+  printf ("\n");
+  printf ("  stores = %d, rejects = %d, written to disk = %d",
+          zswapStores, zswapRejects, zswapEvicts);
+  printf (", hits/misses = %d/%d", zswapHits, zswapMisses);
+  if (total > 0) printf (", hit rate = %.2f%%", 100.0*zswapHits/total);
+  printf ("\n");
+  sem_post (&zswap_mutex);
+}
+
+void initialize_zswap ()
+{
+  zswapTable = (ZswapEntry **) calloc (maxProcess*maxPpages,
+                                       sizeof(ZswapEntry *));
+  sem_init (&zswap_mutex, 0, 1);
+}